@@ -0,0 +1,161 @@
+//Runs the json_corpus benchmarks and fuzzer on a host, away from the
+//robot build (src/ is all compiled for the brain, so this lives out
+//here). Built and run by "make json-bench" and "make json-fuzz", see
+//the Makefile. Exits with 1 if fuzzing or the checks found anything.
+//  json_host [numbers|corpus] [size] [passes]
+//  json_host fuzz [runs] [seed]
+//  json_host check
+#include "json_corpus.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+static uint64_t micros() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void print_heap(const char* what, const json_heap_use& use) {
+  printf("  %s: %ld allocs, %ld B held, %ld B peak\n", what, use.allocs, use.bytes, use.peak);
+}
+
+static void numbers(int samples) {
+  auto result = json_bench_numbers(samples > 0 ? samples : 5000, micros);
+  printf("numbers: %zu values\n", result.values);
+  printf("  ostringstream: %.0f us, %zu B, %d lossy\n", result.ostreamUs, result.ostreamBytes, result.ostreamLossy);
+  printf("  write_number:  %.0f us, %zu B\n", result.writerUs, result.writerBytes);
+}
+
+static void corpus(int size, int passes) {
+  //Same defaults as json_bench.corpus on the robot.
+  static const int defaultSizes[] = {60, 5000, 1000, 32};
+  for(int kind = 0; json_corpus_name(kind); kind++) {
+    auto docs = json_corpus((json_corpus_kind)kind, size > 0 ? size : defaultSizes[kind]);
+    auto result = json_bench(docs, passes, micros);
+    printf("%s: %zu docs, %zu B, parse %.1f MB/s, write %.1f MB/s\n", json_corpus_name(kind),
+      result.docs, result.bytes, result.parse_rate(), result.write_rate());
+    print_heap("parse", result.parseHeap);
+    print_heap("write", result.writeHeap);
+  }
+}
+
+static bool fuzz(int runs, int seed) {
+  auto begin = micros();
+  auto result = json_fuzz(json_fuzz_seeds(), runs > 0 ? runs : 20000, seed);
+  printf("fuzz: %d runs, %d valid, %d failures in %.1f s\n", result.runs, result.valid,
+    result.failures, (micros() - begin) / 1e6);
+  if(result.failures) printf("  first: %s, input %s\n", result.failure, result.failedInput.c_str());
+  return !result.failures;
+}
+
+static int checkFailures = 0;
+
+static void check(bool ok, const char* what) {
+  if(ok) return;
+  printf("  failed: %s\n", what);
+  checkFailures++;
+}
+
+//Shortest %e text that reads back as val, the slow way.
+static std::string shortest_text(double val, bool single) {
+  char text[32];
+  for(int precision = 1; precision <= 17; precision++) {
+    snprintf(text, sizeof(text), "%.*e", precision - 1, val);
+    if(single ? strtof(text, nullptr) == (float)val : strtod(text, nullptr) == val) break;
+  }
+  return text;
+}
+
+//Significant digits, so 1.5e+20 and 150000000000000000000 both have 2.
+static int digit_count(const char* text) {
+  std::string digits;
+  for(; *text && *text != 'e'; text++) {
+    if('0' <= *text && *text <= '9' && (*text != '0' || !digits.empty())) digits += *text;
+  }
+  while(!digits.empty() && digits.back() == '0') digits.pop_back();
+  return digits.size();
+}
+
+//format_number and format_float give back val, in as few digits as any
+//text that does.
+static void check_number(double val, bool single) {
+  char out[json::NUMBER_BUFFER_SIZE + 1];
+  *(single ? json::format_float(val, out) : json::format_number(val, out)) = 0;
+  bool same = single ? strtof(out, nullptr) == (float)val : strtod(out, nullptr) == val;
+  bool shortest = digit_count(out) <= digit_count(shortest_text(val, single).c_str());
+  if(!same || !shortest) printf("  %.17g wrote %s\n", val, out);
+  check(same, single ? "format_float reads back" : "format_number reads back");
+  check(shortest, single ? "format_float is shortest" : "format_number is shortest");
+}
+
+static bool checks() {
+  auto begin = micros();
+  //Grisu2 wrote this one a digit long.
+  char out[json::NUMBER_BUFFER_SIZE + 1];
+  *json::format_number(2.2448710335019179e+279, out) = 0;
+  check(!strcmp(out, "2.244871033501918e+279"), "2.244871033501918e+279 is shortest");
+  for(double val : {2.2448710335019179e+279, 1.7976931348623157e+308, 5e-324, 0.1, 1e21, 1e-7}) {
+    check_number(val, false);
+    check_number(-val, false);
+  }
+  //Random bit patterns, so every exponent comes up.
+  std::mt19937_64 random(1);
+  for(int i = 0; i < 200000; i++) {
+    uint64_t bits = random();
+    double val;
+    float single;
+    memcpy(&val, &bits, sizeof(val));
+    memcpy(&single, &bits, sizeof(single));
+    if(std::isfinite(val)) check_number(val, false);
+    if(std::isfinite(single)) check_number(single, true);
+  }
+  //Packed arrays come back from CBOR as plain arrays, like from text.
+  for(bool single : {false, true}) {
+    std::string cbor;
+    json::numbers({1.5, -2, 0.25}, single).write_cbor(cbor);
+    json back = json::parse_cbor(cbor);
+    check(back.is_array() && back[1].get_number() == -2, "CBOR typed arrays read back as arrays");
+    check(back.to_string() == "[1.5,-2,0.25]", "CBOR typed arrays read back the same");
+  }
+  //CBOR content reads back as the same text, with NaN and infinity as
+  //null, and doubles too big for a float left alone.
+  for(bool single : {false, true}) {
+    json content = json::array({NAN, INFINITY, 1e300, 0.1,
+      json::numbers({1.5, NAN, -INFINITY, 1e300}, single),
+      json::numbers({0.25, 2}, single)});
+    std::string cbor;
+    content.write_cbor(cbor);
+    check(json::parse_cbor(cbor).to_string() == content.to_string(), "CBOR reads back as the same text");
+  }
+  //A key renamed through find() can be found by its new name, in an
+  //object big enough to be indexed.
+  json big = json::object({});
+  for(int i = 0; i < 100; i++) big["key" + std::to_string(i)] = i;
+  big.find("key50")->first = json_key("renamed");
+  check(big.try_get("renamed") && big.try_get("renamed")->get_number() == 50, "find() renames are seen");
+  check(!big.try_get("key50"), "find() renames drop the old name");
+  //Made-up keys from input stop being interned after a while, and then
+  //the same text interned from code still finds them.
+  std::string text = "{";
+  for(int i = 0; i < 600; i++) text += (i ? ",\"input" : "\"input") + std::to_string(i) + "\":" + std::to_string(i);
+  json parsed = json::parse(text + "}");
+  check(parsed["input599"].get_number() == 599, "interned keys find keys that own the same text");
+  check(parsed.object_data_const().size() == 600, "interned keys don't add a second copy");
+  printf("check: %d failures in %.1f s\n", checkFailures, (micros() - begin) / 1e6);
+  return !checkFailures;
+}
+
+int main(int argc, char** argv) {
+  const char* mode = argc > 1 ? argv[1] : "all";
+  int size = argc > 2 ? atoi(argv[2]) : 0;
+  int passes = argc > 3 ? atoi(argv[3]) : 3;
+  if(!strcmp(mode, "check")) return checks() ? 0 : 1;
+  if(!strcmp(mode, "fuzz")) return fuzz(size, argc > 3 ? atoi(argv[3]) : 1) ? 0 : 1;
+  bool all = !strcmp(mode, "all");
+  if(all || !strcmp(mode, "numbers")) numbers(size);
+  if(all || !strcmp(mode, "corpus")) corpus(size, passes);
+  return 0;
+}
@@ -0,0 +1,80 @@
+//Checks OutputRing (src/output_ring.hpp) on a host, with ThreadSanitizer
+//watching. Built and run by "make tabu-check". Exits with 1 if any check
+//failed.
+#include "output_ring.hpp"
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int checkFailures = 0;
+
+static void check(bool ok, const char* what) {
+  if(ok) return;
+  printf("  failed: %s\n", what);
+  checkFailures++;
+}
+
+//One task at a time: full is full, and lines come out in order across
+//the wrap around.
+static void single_checks() {
+  OutputRing ring;
+  std::string line;
+  bool framed;
+  for(int round = 0; round < 3; round++) {
+    for(uint32_t i = 0; i < OutputRing::SIZE; i++) {
+      check(ring.try_add(i % 2, std::to_string(i)), "Lines fit until the ring is full");
+    }
+    check(!ring.try_add(false, "over"), "A full ring turns lines away");
+    check(ring.waiting() == OutputRing::SIZE, "A full ring says it's full");
+    for(uint32_t i = 0; i < OutputRing::SIZE; i++) {
+      bool took = ring.take(line, framed);
+      check(took && line == std::to_string(i) && framed == (bool)(i % 2), "Lines come out in the order they went in");
+    }
+    check(!ring.take(line, framed), "An empty ring has nothing to take");
+    check(ring.waiting() == 0, "An empty ring says it's empty");
+  }
+}
+
+//Several tasks adding at once, as they do on the robot, and the writer
+//taking. Every line comes out once, and each task's in its order.
+static void threaded_checks() {
+  const int PRODUCERS = 4;
+  const int LINES = 20000;
+  OutputRing ring;
+  std::vector<std::thread> producers;
+  for(int p = 0; p < PRODUCERS; p++) {
+    producers.emplace_back([&ring, p]() {
+      for(int i = 0; i < LINES; i++) {
+        std::string line = std::to_string(p) + ":" + std::to_string(i);
+        while(!ring.try_add(p % 2, line)) std::this_thread::yield();
+      }
+    });
+  }
+  std::vector<int> next(PRODUCERS, 0);
+  int taken = 0;
+  int outOfOrder = 0;
+  std::string line;
+  bool framed;
+  while(taken < PRODUCERS * LINES) {
+    if(!ring.take(line, framed)) {
+      std::this_thread::yield();
+      continue;
+    }
+    taken++;
+    int p = std::stoi(line);
+    int i = std::stoi(line.substr(line.find(':') + 1));
+    if(p < 0 || p >= PRODUCERS || i != next[p] || framed != (bool)(p % 2)) outOfOrder++;
+    else next[p]++;
+  }
+  for(auto& producer : producers) producer.join();
+  check(!outOfOrder, "Each task's lines come out once, in order");
+  check(!ring.take(line, framed), "Nothing's left once every line is taken");
+}
+
+int main() {
+  single_checks();
+  threaded_checks();
+  printf("output ring check: %d failures\n", checkFailures);
+  return checkFailures ? 1 : 0;
+}
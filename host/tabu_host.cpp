@@ -0,0 +1,139 @@
+//Checks the parts of tabu that don't need the robot, on a host. Built
+//and run by "make tabu-check", see the Makefile. Exits with 1 if any
+//check failed.
+#include "line_reader.hpp"
+#include "tabu_frame.hpp"
+#include "crc.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static int checkFailures = 0;
+
+static void check(bool ok, const char* what) {
+  if(ok) return;
+  printf("  failed: %s\n", what);
+  checkFailures++;
+}
+
+// ----- LineReader -----
+
+//What the reader reads, handed out in chunks of readSize bytes at most,
+//so lines get split across reads.
+static std::string stream;
+static size_t streamPos = 0;
+static size_t readSize = 1;
+
+//Thrown when the stream runs out, since next would wait forever.
+struct out_of_stream {};
+
+static int read_stream(char* buf, size_t size) {
+  if(streamPos == stream.size()) throw out_of_stream();
+  size_t len = std::min({size, readSize, stream.size() - streamPos});
+  memcpy(buf, stream.data() + streamPos, len);
+  streamPos += len;
+  return len;
+}
+
+struct read_result {
+  std::vector<std::string> lines;
+  uint32_t tooLong;
+};
+
+//Reads up to count lines back out of text.
+static read_result read_lines(const std::string& text, size_t chunk, size_t maxLine, size_t count) {
+  stream = text;
+  streamPos = 0;
+  readSize = chunk;
+  LineReader reader(read_stream, maxLine);
+  read_result ret;
+  try {
+    for(size_t i = 0; i < count; i++) ret.lines.emplace_back(reader.next());
+  } catch(const out_of_stream&) {}
+  ret.tooLong = reader.tooLong;
+  return ret;
+}
+
+static void line_reader_checks() {
+  const size_t MAX = 64;
+  std::string longLine(MAX + 1, 'x');
+  std::string hugeLine(5000, 'y');
+  std::string text = "a\n\nbc\r\n" + std::string(MAX, 'm') + "\n" + longLine + "\nafter\n" + hugeLine + "\nlast\n";
+  std::vector<std::string> want = {"a", "", "bc\r", std::string(MAX, 'm'), "after", "last"};
+  //Every read size, from a byte at a time to all at once.
+  for(size_t chunk : {1, 2, 3, 7, 63, 64, 65, 511, 512, 8192}) {
+    auto got = read_lines(text, chunk, MAX, want.size());
+    check(got.lines == want, "LineReader gives back the lines that fit, whatever the read size");
+    check(got.tooLong == 2, "LineReader counts lines too long to keep");
+    check(streamPos == stream.size(), "LineReader reads up to the last line");
+  }
+  //A line too long right at the end of a read doesn't swallow the next.
+  for(size_t chunk = 1; chunk < 200; chunk++) {
+    auto got = read_lines(longLine + "\n" + longLine + longLine + "\nok\n", chunk, MAX, 1);
+    check(got.lines == std::vector<std::string>{"ok"}, "LineReader picks up again after skipping a line");
+  }
+}
+
+// ----- Frames -----
+
+//Frames line and reads it back, checking it comes back whole.
+static bool round_trips(const std::string& line, uint16_t seq) {
+  std::string frame;
+  tabu_frame(line, seq, frame);
+  if(frame[0] != TABU_FRAME_START || frame.find('\n') != std::string::npos) return false;
+  std::string scratch;
+  uint16_t backSeq;
+  std::string_view back;
+  return tabu_unframe(std::string_view(frame).substr(1), scratch, backSeq, back) == FRAME_OK && back == line && backSeq == seq;
+}
+
+static void frame_checks() {
+  //CRC-32/POSIX without its final xor, which is what VEX_CRC32 from 0 is.
+  check(VEX_CRC32("123456789", 9) == 0x89A1897F, "VEX_CRC32 of the check string");
+  check(VEX_CRC32("56789", 5, VEX_CRC32("1234", 4)) == 0x89A1897F, "VEX_CRC32 carries on from an accumulator");
+  //COBS blocks are 254 bytes, so lengths around that and zeros and
+  //newlines anywhere are the edges.
+  std::mt19937 random(1);
+  for(size_t len : {0, 1, 2, 253, 254, 255, 256, 508, 509, 1000, 5000}) {
+    for(int fill = 0; fill < 4; fill++) {
+      std::string line(len, "\0\n\xff"[fill % 3]);
+      if(fill == 3) for(auto& c : line) c = random();
+      check(round_trips(line, len * 7 + fill), "Frames read back as the line they were made from");
+    }
+  }
+  check(round_trips("=topic/1/{}", 0xFFFF), "Frames keep the whole seq");
+  //Any one byte changed, or any cut short, never reads back as a line.
+  std::string line = "=simple_follower.test/123/{\"pos\":10,\"vel\":5}";
+  std::string frame;
+  tabu_frame(line, 42, frame);
+  frame.erase(0, 1);
+  std::string scratch;
+  uint16_t seq;
+  std::string_view back;
+  int bad = 0;
+  for(size_t i = 0; i < frame.size(); i++) {
+    for(int bit = 0; bit < 8; bit++) {
+      std::string changed = frame;
+      changed[i] ^= 1 << bit;
+      if(tabu_unframe(changed, scratch, seq, back) == FRAME_OK) bad++;
+    }
+    if(tabu_unframe(std::string_view(frame).substr(0, i), scratch, seq, back) == FRAME_OK) bad++;
+  }
+  check(!bad, "Changed or cut frames are turned away");
+  //Garbage has to be turned away without reading past it.
+  for(int i = 0; i < 20000; i++) {
+    std::string junk(random() % 40, '\0');
+    for(auto& c : junk) c = random();
+    tabu_unframe(junk, scratch, seq, back);
+  }
+}
+
+int main() {
+  line_reader_checks();
+  frame_checks();
+  printf("tabu check: %d failures\n", checkFailures);
+  return checkFailures ? 1 : 0;
+}
@@ -6,6 +6,7 @@
 #include "display.hpp"
 #include "superhot_compat.hpp"
 #include "hotdb.hpp"
+#include "json_bind.hpp"
 
 enum class MovementComponent { L, R };
 inline MovementComponent invert(MovementComponent it) {
@@ -26,6 +27,20 @@ struct PathDisturbance {
   }
 };
 
+template<> struct json_bind<PathDisturbance> {
+  static constexpr json_bound_field fields[] = {
+    json_field<&PathDisturbance::dominant>("dominant"),
+    json_field<&PathDisturbance::targetLMax>("targetLMax"),
+    json_field<&PathDisturbance::targetRMax>("targetRMax"),
+    json_field<&PathDisturbance::activationDistance>("activationDistance"),
+    json_field<&PathDisturbance::lower>("lower"),
+    json_field<&PathDisturbance::sustain>("sustain"),
+    json_field<&PathDisturbance::resume>("resume"),
+    json_field<&PathDisturbance::used>("used", true)
+  };
+  static constexpr json_binding binding = {fields, std::size(fields)};
+};
+
 struct PIDOutput {
   virtual double getProgress() = 0;
   virtual double getAvgVel() = 0;
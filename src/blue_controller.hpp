@@ -71,10 +71,15 @@ namespace bros {
     }
     //Starts listening for tabu mesesages.
     void init_listen() {
-      tabu_on(prefix + ".move", [&](Message msg) {
-        axes[msg.integer("axis")] = msg.number("value");
+      //Moves come in fast, so they skip building a json for each one.
+      tabu_on_raw(prefix + ".move", [&](const Message&, std::string_view content) {
+        json_fields fields({"axis", "value"});
+        json_parse_error error;
+        if(!json::try_parse_events(content, fields, error) || !fields.has(0) || !fields.has(1)) return;
+        int axis = fields.get(0);
+        if(axis >= 0 && axis < 4) axes[axis] = fields.get(1);
       });
-      tabu_on(prefix + ".key", [&](Message msg) {
+      tabu_on(prefix + ".key", [&](const Message& msg) {
         buttons[msg.integer("num")] = msg.boolean("pressed");
       });
     }
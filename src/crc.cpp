@@ -0,0 +1,34 @@
+#include "crc.hpp"
+
+inline uint32_t mask32(int size) {
+  return ((uint32_t)-1 >> (32 - size));
+}
+
+//From prosv5
+CRC::CRC(uint32_t isize, uint32_t poly): size(isize) {
+  for(uint32_t i = 0; i < 256; i++) {
+    uint32_t acc = i << (size - 8);
+    for(int j = 0; j < 8; j++) {
+      if(acc & (1u << (size - 1))) {
+        acc <<= 1;
+        acc ^= poly;
+      } else acc <<= 1;
+    }
+    table[i] = acc & mask32(size);
+  }
+}
+
+uint32_t CRC::operator()(const bytes& data, uint32_t acc) const {
+  return (*this)(data.data(), data.size(), acc);
+}
+
+uint32_t CRC::operator()(const void* data, size_t len, uint32_t acc) const {
+  auto pos = (const uint8_t*)data;
+  for(size_t i = 0; i < len; i++) {
+    uint8_t index = (acc >> (size - 8)) ^ pos[i];
+    acc = ((acc << 8) ^ table[index]) & mask32(size);
+  }
+  return acc;
+}
+
+const CRC VEX_CRC32 = CRC(32, 0x04C11DB7);
@@ -0,0 +1,21 @@
+#pragma once
+//Table-driven CRCs, most significant bit first, with no reflection or
+//final xor. VEX_CRC32 is the one PROS uses for uploads, and tabu frames
+//(tabu_frame.hpp) use it too.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using bytes = std::vector<unsigned char>;
+
+class CRC {
+  uint32_t size;
+  uint32_t table[256];
+  public:
+  CRC(uint32_t size, uint32_t poly);
+  uint32_t operator()(const bytes& data, uint32_t accumulator = 0) const;
+  uint32_t operator()(const void* data, size_t len, uint32_t accumulator = 0) const;
+};
+
+extern const CRC VEX_CRC32;
@@ -6,6 +6,7 @@
 #include "sensors.hpp"
 #include "mtrs.hpp"
 #include "automation_util.hpp"
+#include "json_bind.hpp"
   
 enum TailKind {
   BY_TIME,
@@ -52,6 +53,43 @@ struct Position {
   double dVel;
 };
 
+template<> struct json_bind<Tail> {
+  static constexpr json_bound_field fields[] = {
+    json_field<&Tail::kind>("kind"),
+    json_field<&Tail::loc>("loc")
+  };
+  static constexpr json_binding binding = {fields, std::size(fields)};
+};
+
+//Keys are the ones simple_follower.test is sent.
+template<> struct json_bind<Trial> {
+  static constexpr json_bound_field fields[] = {
+    json_field<&Trial::d>("pos"),
+    json_field<&Trial::v>("vel"),
+    json_field<&Trial::a>("acc"),
+    json_field<&Trial::j>("jrk"),
+    json_field<&Trial::kV>("kV"),
+    json_field<&Trial::kA>("kA"),
+    json_field<&Trial::beginTail>("beginTail", true),
+    json_field<&Trial::endTail>("endTail", true),
+    json_field<&Trial::stopOnFinish>("stopOnFinish"),
+    json_field<&Trial::stopBrakeMode>("stopBrakeMode"),
+    json_field<&Trial::feedbackOn>("feedbackEnabled")
+  };
+  static constexpr json_binding binding = {fields, std::size(fields)};
+};
+
+template<> struct json_bind<Position> {
+  static constexpr json_bound_field fields[] = {
+    json_field<&Position::time>("time"),
+    json_field<&Position::disp>("disp"),
+    json_field<&Position::cVel>("cVel"),
+    json_field<&Position::mVel>("mVel"),
+    json_field<&Position::dVel>("dVel")
+  };
+  static constexpr json_binding binding = {fields, std::size(fields)};
+};
+
 struct TrialResults {
   Trial trial;
   std::vector<Position> sampledPosition;
@@ -197,59 +235,55 @@ TrialResults recordMotorMax() {
   return res;
 }
 
+//Sampled positions, written out to be graphed.
+static void writePositions(const std::vector<Position>& positions, bool columnar, std::string& out) {
+  if(columnar) {
+    json_table_of(positions).to_columns(true).write(out);
+  } else {
+    json_write(positions, out);
+  }
+}
+
 void init_follow_test() {
-  tabu_reply_on("simple_follower.max_test", []() -> json {
+  tabu_reply_written_on("simple_follower.max_test", [](const Message& msg, std::string& out) {
     pauseControl();
     auto data = recordMotorMax();
     returnToWall();
     resumeControl();
-    auto jarr = json::array({});
-    for(auto& entry: data.sampledPosition) {
-      jarr.array_data().push_back(json::object({
-        {"time", entry.time},
-        {"disp", entry.disp},
-        {"cVel", entry.cVel},
-        {"mVel", entry.mVel},
-        {"dVel", entry.dVel}
-      }));
-    }
-    return jarr;
-  });
+    writePositions(data.sampledPosition, msg.flag("columnar"), out);
+  }, OWN_TASK);
   tabu_help("simple_follower.max_test", {
     tlabel("Moves motors at full speed for 1sec, records motor statistics."),
+    tbool("columnar"),
     treplyaction("graph(it)")
   });
-  tabu_reply_on("simple_follower.test", [](Message message) -> json {
-    pauseControl();
-    auto data = doTest({
-      message.number("pos"),
-      message.number("vel"),
-      message.number("acc"),
-      message.number("jrk"),
-      message.number("kV"),
-      message.number("kA"),
-      {BY_DIST, 1},
-      {BY_VEL, velToInches(24)},
-      message.boolean("stopOnFinish"),
-      (okapi::AbstractMotor::brakeMode)message.integer("stopBrakeMode"),
-      message.boolean("feedbackEnabled")
-    });
-    returnToWall();
-    resumeControl();
-    auto jarr = json::array({});
-    for(auto& entry: data.sampledPosition) {
-      jarr.array_data().push_back(json::object({
-        {"time", entry.time},
-        {"disp", entry.disp},
-        {"cVel", entry.cVel},
-        {"mVel", entry.mVel},
-        {"dVel", entry.dVel}
-      }));
+  //The trial is read straight from the raw text, no json is made for it.
+  //The test runs for seconds, so it gets a task of its own.
+  tabu_on_raw("simple_follower.test", [](const Message& message, std::string_view content) {
+    Trial trial = {};
+    //Tails can be sent, but usually aren't.
+    trial.beginTail = {BY_DIST, 1};
+    trial.endTail = {BY_VEL, velToInches(24)};
+    json_parse_error error;
+    if(!json_try_read(content, trial, error)) {
+      printf("Bad simple_follower.test trial: %s\n", error.message().c_str());
+      return;
     }
-    return json::object({
-      {"graphable", jarr},
-      {"finalVel", data.finalVelocity}
-    });
+    json_fields fields({"columnar"});
+    json_parse_error flagError;
+    bool columnar = json::try_parse_events(content, fields, flagError) && fields.has(0) && fields.get(0);
+    tabu_run_async([message, trial, columnar]() {
+      pauseControl();
+      auto data = doTest(trial);
+      returnToWall();
+      resumeControl();
+      std::string out = "{\"graphable\":";
+      writePositions(data.sampledPosition, columnar, out);
+      out += ",\"finalVel\":";
+      json::write_number(data.finalVelocity, out);
+      out += '}';
+      tabu_send_big_written(message, std::move(out));
+    }, OWN_TASK);
   });
   tabu_help("simple_follower.test", {
     tlabel("Motion profiling tester."),
@@ -257,6 +291,7 @@ void init_follow_test() {
     tbool("stopOnFinish"),
     tnum("stopBrakeMode"),
     tbool("feedbackEnabled"),
+    tbool("columnar"),
     treplyaction("graph(it.graphable); say('Final vel was ' + it.finalVel)")
   });
 }
\ No newline at end of file
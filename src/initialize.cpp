@@ -8,11 +8,18 @@
 #include "display.hpp"
 #include "superhot_compat.hpp"
 #include "blackbox.hpp"
+#include "jsonbench.hpp"
+#include "line_reader.hpp"
+#include "crc.hpp"
 
 void inputTask(void*) {
 	while(true) {
+#ifdef SUPERHOT_ENABLED
 		auto line = SuperHot::recv_line();
 		tabu_handler(line);
+#else
+		tabu_handler(tabu_input().next());
+#endif
 	}
 }
 
@@ -32,44 +39,6 @@ void init_atoms() {
 	hawt_atoms = new std::unordered_map<std::string, void*>;
 }
 
-using bytes = std::vector<unsigned char>;
-
-class CRC {
-  uint32_t size;
-  uint32_t table[256];
-  public:
-  CRC(uint32_t size, uint32_t poly);
-  uint32_t operator()(const bytes& data, uint32_t accumulator = 0);
-};
-
-inline uint32_t mask32(int size) {
-  return ((uint32_t)-1 >> (32 - size));
-}
-
-//From prosv5
-CRC::CRC(uint32_t isize, uint32_t poly): size(isize) {
-  for(uint32_t i = 0; i < 256; i++) {
-    uint32_t acc = i << (size - 8);
-    for(int j = 0; j < 8; j++) {
-      if(acc & (1 << (size - 1))) {
-        acc <<= 1;
-        acc ^= poly;
-      } else acc <<= 1;
-    }
-    table[i] = acc & mask32(size);
-  }
-}
-
-uint32_t CRC::operator()(const bytes& data, uint32_t acc) {
-  for(auto& d: data) {
-    uint8_t i = (acc >> (size-8)) ^ d;
-    acc = ((acc << 8) ^ table[i]) & mask32(size);
-  }
-  return acc;
-}
-
-CRC VEX_CRC32 = CRC(32, 0x04C11DB7);
-
 bytes fromBuffer(void* buf, int len) {
 	bytes vec;
 	vec.resize(len);
@@ -90,6 +59,7 @@ extern "C" {
  */
 void r_initialize() {
 	try {
+		tabu_start_output();
 		//Safety
 		if(pros::competition::is_connected() && !pros::competition::is_disabled()) {
 			willRunSelector = false;
@@ -103,6 +73,9 @@ void r_initialize() {
 		init_follow_test();
 		init_pid_test();
 		init_blackbox();
+#ifdef JSON_BENCH
+		init_json_bench();
+#endif
 
 		tabu_reply_on("ping", [](const Message& msg) -> json {
 			return "Got ping message with content " + msg.content.to_string() + ".";
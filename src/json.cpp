@@ -1,223 +1,967 @@
 #include "json.hpp"
-#include <sstream>
-#include <iomanip>
-#include <iostream>
-#include <ios>
-#include <sstream>
-#include <iomanip>
-#include <iostream>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cfloat>
+#include <cmath>
+#include <atomic>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-class json::impl {
-  friend json;
-  //pairs represents the content of a JOBJECT
-  //values represents the content of a JARRAY
-  //Neither are used when in another mode.
-  //Also, it's purely a quirk of g++ that this works.
-  //std::vector of an incomplete type isn't supposed to work.
-  std::vector<json> values;
-  std::vector<std::pair<std::string, json>> pairs;
-  public:
-  //Initialization Methods
-  //You can make JSON values this way and nest them to make an awkward JSON literal.
-  impl();
+struct json::impl {
+  //Only the member matching kind is alive. The owning json knows
+  //its kind too, but keeping it here lets impl copy and destroy itself.
+  json_type kind;
+  //Strings in a json_arena are views into it instead of std::strings.
+  bool is_view = false;
+  //Packed numbers get written with float precision.
+  bool single = false;
+  //How many jsons share this. Copies share until one of them changes,
+  //which then gets its own (see json::own). Unused in arenas.
+  std::atomic<int> refs{1};
+  union {
+    std::string str;
+    std::string_view view;
+    std::vector<json> values;
+    std::vector<std::pair<json_key, json>> pairs;
+    std::vector<double> numbers;
+  };
+  impl(json_type ikind);
+  impl(std::string_view arenaText);
   impl(const impl& orig);
-  impl& operator=(const impl& orig);
+  impl& operator=(const impl& orig) = delete;
+  ~impl();
+  //Hash index over pairs, only made once an object gets big.
+  struct key_index;
+  key_index* index = nullptr;
+  inline std::string_view text() const { return is_view ? view : std::string_view(str); }
+  //Position of key in pairs, or pairs.size() when it isn't there.
+  //Only an unshared impl may build its index (build), since shared ones
+  //can be read from several tasks at once. Others use a finished
+  //index if there is one, and otherwise just search.
+  size_t find_key(std::string_view key, bool build);
+  size_t find_key(const json_key& key, bool build);
+  //Brings the index up to date with pairs, making it if it's big enough.
+  void update_index();
+  //Forgets the index, for when pairs might've been changed behind its back.
+  void drop_index();
+  //For json_arena cleanups.
+  static void destroy(void* it) { ((impl*)it)->~impl(); }
 
-  json& set_array(std::initializer_list<json> vals);
+  //Parsing
+  //The parser state, and its helper functions for each kind of JSON data.
+  struct parser;
+  //Serialization
+  //Appends val onto out. When there's a sink, out gets flushed into it
+  //every so often so it never has to hold the whole document.
+  static void write(const json& val, std::string& out, json_sink* sink);
+  static void flush(std::string& out, json_sink* sink);
+  static void write_numbers(const impl& packed, std::string& out, json_sink* sink);
+  static void utf8_to_16_escaped(std::string_view text, std::string& out);
+};
+
+json::impl::impl(json_type ikind): kind(ikind) {
+  if(kind == JSTRING) new (&str) std::string();
+  else if(kind == JARRAY) new (&values) std::vector<json>();
+  else if(kind == JNUMBERS) new (&numbers) std::vector<double>();
+  else new (&pairs) std::vector<std::pair<json_key, json>>();
+}
 
-  json& set_object(std::initializer_list<std::pair<std::string, json>> vals);
+json::impl::impl(std::string_view arenaText): kind(JSTRING), is_view(true), view(arenaText) {}
 
-  //Parsing
-  //This will populate the object with the data contained in the string.
-  //Helper functions parse each kind of JSON data.
-  private:
-  static json parse(const std::string& data, int &idx);
-  static json parse_array(const std::string& data, int& idx);
-  static json parse_object(const std::string& data, int& idx);
-  static void skip_whitespace(const std::string& data, int& idx);
-  static json parse_string(const std::string& data, int& idx);
-  static std::string utf8_to_16_escaped(const std::string& text);
+//Copies always end up on the heap, even when orig is in an arena.
+json::impl::impl(const json::impl& orig): kind(orig.kind), single(orig.single) {
+  if(kind == JSTRING) new (&str) std::string(orig.text());
+  else if(kind == JARRAY) new (&values) std::vector<json>(orig.values);
+  else if(kind == JNUMBERS) new (&numbers) std::vector<double>(orig.numbers);
+  else new (&pairs) std::vector<std::pair<json_key, json>>(orig.pairs);
+}
+
+json::impl::~impl() {
+  if(kind == JSTRING) {
+    if(!is_view) str.~basic_string();
+  }
+  else if(kind == JARRAY) values.~vector();
+  else if(kind == JNUMBERS) numbers.~vector();
+  else {
+    pairs.~vector();
+    drop_index();
+  }
+}
+
+static uint32_t hash_key(std::string_view key) {
+  //FNV-1a
+  uint32_t h = 2166136261u;
+  for(unsigned char c: key) {
+    h ^= c;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// ----- Key interning -----
+
+struct json_key::entry {
+  uint32_t hash;
+  uint32_t size;
+  //Interned entries live forever. Others are shared between copies of
+  //a key, and freed when the last one goes.
+  bool interned;
+  std::atomic<int> refs;
+  char text[1];
+};
+
+//Keys longer than this aren't worth interning, they're rarely repeated.
+static const size_t MAX_INTERNED_SIZE = 32;
+//The table never shrinks, so it's a fixed size, and stops taking keys
+//once it's half full to keep probing short.
+static const size_t INTERN_SLOTS = 1024;
+static const size_t MAX_INTERNED = INTERN_SLOTS / 2;
+//Keys from parsed input are anything a peer cares to send, and interned
+//ones are never freed. So they only get interned while they're short and
+//there haven't been too many of them, which leaves the rest of the table
+//for keys from code. Past that they own their text like long keys do.
+static const size_t MAX_INPUT_INTERNED_SIZE = 16;
+static const size_t MAX_INPUT_INTERNED = MAX_INTERNED / 4;
+//Slots are only ever filled in, with a compare and swap, so reading
+//needs no lock, and neither does adding.
+static std::atomic<const json_key::entry*> internSlots[INTERN_SLOTS];
+static std::atomic<size_t> internCount{0};
+static std::atomic<size_t> inputInternCount{0};
+static const json_key::entry emptyKey = {2166136261u, 0, true, {1}, {0}};
+
+static json_key::entry* make_entry(std::string_view text, uint32_t hash, bool interned) {
+  auto ret = (json_key::entry*)malloc(offsetof(json_key::entry, text) + text.size() + 1);
+  if(!ret) throw std::bad_alloc();
+  ret->hash = hash;
+  ret->size = text.size();
+  ret->interned = interned;
+  new(&ret->refs) std::atomic<int>(1);
+  memcpy(ret->text, text.data(), text.size());
+  ret->text[text.size()] = 0;
+  return ret;
+}
+
+static inline bool entry_is(const json_key::entry* e, std::string_view text, uint32_t hash) {
+  return e->hash == hash && e->size == text.size() && memcmp(e->text, text.data(), text.size()) == 0;
+}
+
+const json_key::entry* json_key::find_interned(std::string_view text, uint32_t hash) {
+  if(text.empty()) return &emptyKey;
+  if(text.size() > MAX_INTERNED_SIZE) return nullptr;
+  for(size_t slot = hash & (INTERN_SLOTS - 1);; slot = (slot + 1) & (INTERN_SLOTS - 1)) {
+    const entry* e = internSlots[slot].load(std::memory_order_acquire);
+    if(!e) return nullptr;
+    if(entry_is(e, text, hash)) return e;
+  }
+}
+
+//Takes a place in the table for a new key, false if there's none left.
+static bool claim_intern(size_t size, bool input) {
+  if(input) {
+    if(size > MAX_INPUT_INTERNED_SIZE) return false;
+    if(inputInternCount.fetch_add(1, std::memory_order_relaxed) >= MAX_INPUT_INTERNED) {
+      inputInternCount.fetch_sub(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  if(internCount.fetch_add(1, std::memory_order_relaxed) >= MAX_INTERNED) {
+    internCount.fetch_sub(1, std::memory_order_relaxed);
+    if(input) inputInternCount.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+static void unclaim_intern(bool input) {
+  internCount.fetch_sub(1, std::memory_order_relaxed);
+  if(input) inputInternCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+const json_key::entry* json_key::intern(std::string_view text, uint32_t hash, bool input) {
+  if(text.empty()) return &emptyKey;
+  if(text.size() > MAX_INTERNED_SIZE) return make_entry(text, hash, false);
+  entry* fresh = nullptr;
+  for(size_t slot = hash & (INTERN_SLOTS - 1);; slot = (slot + 1) & (INTERN_SLOTS - 1)) {
+    const entry* e = internSlots[slot].load(std::memory_order_acquire);
+    if(!e) {
+      //Claim a spot in the table before taking a slot.
+      if(!fresh) {
+        if(!claim_intern(text.size(), input)) return make_entry(text, hash, false);
+        fresh = make_entry(text, hash, true);
+      }
+      if(internSlots[slot].compare_exchange_strong(e, fresh, std::memory_order_acq_rel)) return fresh;
+      //Someone else got this slot first, see what they put there.
+    }
+    if(entry_is(e, text, hash)) {
+      if(fresh) {
+        free(fresh);
+        unclaim_intern(input);
+      }
+      return e;
+    }
+  }
+}
+
+json_key::json_key(std::string_view text): ptr(intern(text, hash_key(text), false)) {}
+
+json_key json_key::from_input(std::string_view text) {
+  return json_key(intern(text, hash_key(text), true));
+}
+
+json_key::json_key(const json_key& orig): ptr(orig.ptr) {
+  if(!ptr->interned) const_cast<entry*>(ptr)->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+json_key::json_key(json_key&& orig) noexcept: ptr(orig.ptr) {
+  orig.ptr = &emptyKey;
+}
+
+json_key& json_key::operator=(const json_key& orig) {
+  if(this == &orig) return *this;
+  json_key copy(orig);
+  return *this = std::move(copy);
+}
+
+json_key& json_key::operator=(json_key&& orig) noexcept {
+  std::swap(ptr, orig.ptr);
+  return *this;
+}
+
+json_key::~json_key() {
+  if(ptr->interned) return;
+  if(const_cast<entry*>(ptr)->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) free((void*)ptr);
+}
+
+std::string_view json_key::view() const {
+  return std::string_view(ptr->text, ptr->size);
+}
+
+uint32_t json_key::hash() const {
+  return ptr->hash;
+}
+
+bool json_key::operator==(const json_key& other) const {
+  if(ptr == other.ptr) return true;
+  //Interned text only exists once, so a different interned pointer
+  //means different text. Keys that own their text need a real look,
+  //even against interned ones: a key that lost a race for the last
+  //place in the table owns a copy of text that might've been interned.
+  if(ptr->interned && other.ptr->interned) return false;
+  return ptr->hash == other.ptr->hash && view() == other.view();
+}
+
+// ----- Object key index -----
+
+//Objects with fewer keys than this are just searched in order, which
+//beats hashing at that size. Bigger ones get a key_index.
+static const size_t INDEX_THRESHOLD = 16;
+
+//Open addressing table of positions in pairs. Keys are only ever
+//appended through json, so the index catches up by hashing whatever
+//was added since it last looked.
+struct json::impl::key_index {
+  //Position in pairs + 1, or 0 for an empty slot. Size is a power of 2.
+  std::vector<uint32_t> slots;
+  //How many of pairs are in slots.
+  size_t indexed = 0;
 };
 
-json::impl::impl() = default;
-json::impl::impl(const json::impl& orig) = default;
-json::impl& json::impl::operator=(const json::impl& orig) = default;
+void json::impl::drop_index() {
+  delete index;
+  index = nullptr;
+}
+
+void json::impl::update_index() {
+  size_t size = pairs.size();
+  if(size < INDEX_THRESHOLD) return;
+  if(!index) index = new key_index;
+  auto& idx = *index;
+  //Keep the table at most half full.
+  if(idx.indexed > size || idx.slots.size() < size * 2) {
+    size_t capacity = 32;
+    while(capacity < size * 4) capacity *= 2;
+    idx.slots.assign(capacity, 0);
+    idx.indexed = 0;
+  }
+  size_t mask = idx.slots.size() - 1;
+  for(; idx.indexed < size; idx.indexed++) {
+    size_t slot = pairs[idx.indexed].first.hash() & mask;
+    while(idx.slots[slot]) slot = (slot + 1) & mask;
+    idx.slots[slot] = idx.indexed + 1;
+  }
+}
+
+size_t json::impl::find_key(std::string_view key, bool build) {
+  uint32_t hash = hash_key(key);
+  const json_key::entry* interned = json_key::find_interned(key, hash);
+  size_t size = pairs.size();
+  if(size >= INDEX_THRESHOLD && build) update_index();
+  //Interned text matches its own pointer without a look at the text.
+  //Otherwise only keys that own their text can match, and that can
+  //happen even when the text's interned, see json_key::operator==.
+  auto matches = [&](const json_key& candidate) {
+    if(candidate.ptr == interned) return true;
+    return !candidate.ptr->interned && candidate.ptr->hash == hash && candidate.view() == key;
+  };
+  if(size < INDEX_THRESHOLD || !index || index->indexed != size) {
+    for(size_t i = 0; i < size; i++) {
+      if(matches(pairs[i].first)) return i;
+    }
+    return size;
+  }
+  auto& idx = *index;
+  size_t mask = idx.slots.size() - 1;
+  for(size_t slot = hash & mask; idx.slots[slot]; slot = (slot + 1) & mask) {
+    size_t i = idx.slots[slot] - 1;
+    if(matches(pairs[i].first)) return i;
+  }
+  return size;
+}
+
+size_t json::impl::find_key(const json_key& key, bool build) {
+  if(!key.ptr->interned) return find_key(key.view(), build);
+  size_t size = pairs.size();
+  if(size >= INDEX_THRESHOLD && build) update_index();
+  if(size < INDEX_THRESHOLD || !index || index->indexed != size) {
+    for(size_t i = 0; i < size; i++) {
+      if(pairs[i].first == key) return i;
+    }
+    return size;
+  }
+  auto& idx = *index;
+  size_t mask = idx.slots.size() - 1;
+  for(size_t slot = key.hash() & mask; idx.slots[slot]; slot = (slot + 1) & mask) {
+    size_t i = idx.slots[slot] - 1;
+    if(pairs[i].first == key) return i;
+  }
+  return size;
+}
+
+void json::release() {
+  if(!in_arena && pImpl->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete pImpl;
+  in_arena = false;
+  kind = JNULL;
+  dbl_value = 0;
+}
+
+json::impl& json::reset_impl(json_type to) {
+  if(has_impl()) {
+    if(pImpl->kind == to && !in_arena && pImpl->refs.load(std::memory_order_acquire) == 1) {
+      //Reuse the slot we already have.
+      if(to == JSTRING) pImpl->str.clear();
+      else if(to == JARRAY) pImpl->values.clear();
+      else if(to == JNUMBERS) pImpl->numbers.clear();
+      else {
+        pImpl->pairs.clear();
+        pImpl->drop_index();
+      }
+      kind = to;
+      return *pImpl;
+    }
+    release();
+  }
+  pImpl = new impl(to);
+  kind = to;
+  return *pImpl;
+}
+
+json::impl& json::own() {
+  if(in_arena || pImpl->refs.load(std::memory_order_acquire) > 1) {
+    //Children are copies too, so they only get copied for real
+    //once they're changed themselves.
+    impl* mine = new impl(*pImpl);
+    json_type was = kind;
+    release();
+    pImpl = mine;
+    kind = was;
+  }
+  return *pImpl;
+}
+
+std::vector<json>& json::array_data() {
+  if(!is_array()) throw std::runtime_error("I am not an array");
+  return own().values;
+}
+const std::vector<json>& json::array_data_const() const {
+  if(!is_array()) throw std::runtime_error("I am not an array");
+  return pImpl->values;
+}
+std::vector<std::pair<json_key, json>>& json::object_data() {
+  if(!is_object()) throw std::runtime_error("I am not an object");
+  //The caller could do anything to pairs, so the index can't be trusted.
+  auto& mine = own();
+  mine.drop_index();
+  return mine.pairs;
+}
+const std::vector<std::pair<json_key, json>>& json::object_data_const() const {
+  if(!is_object()) throw std::runtime_error("I am not an object");
+  return pImpl->pairs;
+}
+
+std::vector<double>& json::numbers_data() {
+  if(!is_numbers()) throw std::runtime_error("I am not a number array");
+  return own().numbers;
+}
+const std::vector<double>& json::numbers_data_const() const {
+  if(!is_numbers()) throw std::runtime_error("I am not a number array");
+  return pImpl->numbers;
+}
+bool json::numbers_single() const {
+  if(!is_numbers()) throw std::runtime_error("I am not a number array");
+  return pImpl->single;
+}
+
+json& json::set_string(std::string val) {
+  reset_impl(JSTRING).str = std::move(val);
+  return *this;
+}
+
+std::string json::get_string() const {
+  if(!is_string()) throw std::runtime_error("I am not a string");
+  return std::string(pImpl->text());
+}
 
-json json::parse(const std::string& data) {
-  int idx = 0;
-  return json::impl::parse(data, idx);
+std::string_view json::get_string_view() const {
+  if(!is_string()) throw std::runtime_error("I am not a string");
+  return pImpl->text();
 }
 
-std::vector<json>& json::array_data() { return pImpl->values; }
-const std::vector<json>& json::array_data_const() const { return pImpl->values; }
-std::vector<std::pair<std::string, json>>& json::object_data() { return pImpl->pairs; }
-const std::vector<std::pair<std::string, json>>& json::object_data_const() const { return pImpl->pairs; }
+bool json::try_get_string(std::string_view& out) const {
+  if(!is_string()) return false;
+  out = pImpl->text();
+  return true;
+}
+
+const json* json::try_get(std::string_view key) const {
+  if(!is_object()) return nullptr;
+  size_t pos = pImpl->find_key(key, false);
+  return pos < pImpl->pairs.size() ? &pImpl->pairs[pos].second : nullptr;
+}
 
 json& json::set_array(std::initializer_list<json> vals) {
-  kind = JARRAY;
-  pImpl->pairs.clear();
-  pImpl->values.clear();
-  pImpl->values.reserve(vals.size());
-  pImpl->values.insert(pImpl->values.begin(), vals);
+  auto& values = reset_impl(JARRAY).values;
+  values.reserve(vals.size());
+  values.insert(values.begin(), vals);
   return *this;
 }
 
 json& json::set_object(std::initializer_list<std::pair<std::string, json>> vals) {
-  kind = JOBJECT;
-  pImpl->pairs.clear();
-  pImpl->values.clear();
-  pImpl->pairs.reserve(vals.size());
-  pImpl->pairs.insert(pImpl->pairs.begin(), vals);
+  auto& pairs = reset_impl(JOBJECT).pairs;
+  pairs.reserve(vals.size());
+  for(auto& val: vals) pairs.emplace_back(val.first, val.second);
   return *this;
 }
 
+json& json::set_numbers(std::vector<double> vals, bool single) {
+  auto& packed = reset_impl(JNUMBERS);
+  packed.numbers = std::move(vals);
+  packed.single = single;
+  return *this;
+}
+
+//Size at which buffered output is handed to a json_sink.
+static const size_t SINK_BLOCK = 512;
+
+void json::impl::flush(std::string& out, json_sink* sink) {
+  if(sink && out.size() >= SINK_BLOCK) {
+    sink->put(out.data(), out.size());
+    out.clear();
+  }
+}
+
+void json::impl::write(const json& val, std::string& out, json_sink* sink) {
+  switch(val.kind) {
+    case JNULL: out += "null"; return;
+    case JBOOL: out += val.bool_value ? "true" : "false"; return;
+    case JSTRING: utf8_to_16_escaped(val.pImpl->text(), out); return;
+    case JNUM: write_number(val.dbl_value, out); return;
+    case JARRAY: {
+      out += '[';
+      bool loopRanOnce = false;
+      for(auto& obj: val.pImpl->values) {
+        if(loopRanOnce) out += ',';
+        write(obj, out, sink);
+        flush(out, sink);
+        loopRanOnce = true;
+      }
+      out += ']';
+      return;
+    }
+    case JOBJECT: {
+      out += '{';
+      bool loopRanOnce = false;
+      for(auto& obj: val.pImpl->pairs) {
+        if(loopRanOnce) out += ',';
+        utf8_to_16_escaped(obj.first, out);
+        out += ':';
+        write(obj.second, out, sink);
+        flush(out, sink);
+        loopRanOnce = true;
+      }
+      out += '}';
+      return;
+    }
+    case JNUMBERS: write_numbers(*val.pImpl, out, sink); return;
+  }
+  throw std::runtime_error("Unknown object type");
+}
+
+void json::impl::write_numbers(const impl& packed, std::string& out, json_sink* sink) {
+  //Numbers are formatted into a block on the stack, and only
+  //appended onto out once the block is full.
+  char block[SINK_BLOCK];
+  char* pos = block;
+  char* blockEnd = block + SINK_BLOCK - NUMBER_BUFFER_SIZE - 1;
+  *pos++ = '[';
+  for(size_t i = 0; i < packed.numbers.size(); i++) {
+    if(i) *pos++ = ',';
+    double val = packed.numbers[i];
+    //Casting what a float can't hold to one is undefined, those are
+    //written as doubles (or null) instead.
+    pos = packed.single && std::fabs(val) <= FLT_MAX ? format_float((float)val, pos) : format_number(val, pos);
+    if(pos >= blockEnd) {
+      out.append(block, pos - block);
+      pos = block;
+      flush(out, sink);
+    }
+  }
+  *pos++ = ']';
+  out.append(block, pos - block);
+}
+
+void json::write(std::string& out) const {
+  json::impl::write(*this, out, nullptr);
+}
+
+void json::write(json_sink& out) const {
+  std::string buffer;
+  buffer.reserve(SINK_BLOCK * 2);
+  json::impl::write(*this, buffer, &out);
+  if(!buffer.empty()) out.put(buffer.data(), buffer.size());
+}
+
+void json::write_string(std::string_view text, std::string& out) {
+  json::impl::utf8_to_16_escaped(text, out);
+}
+
 std::string json::to_string() const {
-  if(is_null()) return "null";
-  if(is_bool()) return get_bool() ? "true" : "false";
-  if(is_string()) return json::impl::utf8_to_16_escaped(get_string());
-  if(is_number()) {
-    std::ostringstream ret;
-    ret << get_number();
-    return ret.str();
-  }
-  if(is_array()) {
-    std::string ret = "[";
-    bool loopRanOnce = false;
-    for(auto& obj: array_data_const()) {
-      if(loopRanOnce) ret += ',';
-      ret += obj.to_string();
-      loopRanOnce = true;
+  std::string ret;
+  write(ret);
+  return ret;
+}
+
+// ----- json_arena -----
+
+struct json_arena::block {
+  block* next;
+};
+
+struct json_arena::cleanup {
+  cleanup* next;
+  void (*destroy)(void*);
+};
+
+//Everything handed out is aligned for a double.
+static const size_t ARENA_ALIGN = 8;
+static inline size_t align_up(size_t size) {
+  return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+json_arena::~json_arena() {
+  for(cleanup* c = cleanups; c; c = c->next) {
+    c->destroy((char*)c + align_up(sizeof(cleanup)));
+  }
+  while(blocks) {
+    block* next = blocks->next;
+    free(blocks);
+    blocks = next;
+  }
+}
+
+void* json_arena::alloc(size_t size) {
+  size = align_up(size);
+  if(size > (size_t)(end - pos)) {
+    //Blocks grow as the document does, up to 4K at a time.
+    size_t blockSize = std::max(size, nextBlock);
+    nextBlock = std::min(nextBlock * 2, (size_t)4096);
+    size_t header = align_up(sizeof(block));
+    block* fresh = (block*)malloc(header + blockSize);
+    if(!fresh) throw std::bad_alloc();
+    fresh->next = blocks;
+    blocks = fresh;
+    pos = (char*)fresh + header;
+    end = pos + blockSize;
+  }
+  used += size;
+  void* ret = pos;
+  pos += size;
+  return ret;
+}
+
+void* json_arena::alloc_cleanup(size_t size, void (*destroy)(void*)) {
+  size_t header = align_up(sizeof(cleanup));
+  cleanup* c = (cleanup*)alloc(header + size);
+  c->destroy = destroy;
+  c->next = cleanups;
+  cleanups = c;
+  return (char*)c + header;
+}
+
+std::string_view json_arena::adopt(std::string text) {
+  if(source.empty()) {
+    source = std::move(text);
+    return source;
+  }
+  return copy(text);
+}
+
+std::string_view json_arena::copy(std::string_view text) {
+  if(text.empty()) return std::string_view();
+  char* dest = (char*)alloc(text.size());
+  memcpy(dest, text.data(), text.size());
+  return std::string_view(dest, text.size());
+}
+
+// ----- Scanning -----
+
+//Counts the bytes at the start of text that can be copied as they are,
+//which is nearly always all of them. Reading stops at '"' and '\\'.
+//Writing also stops at '/', control bytes and anything non-ASCII, which
+//all get escaped. Blocks of 16 (or 32) bytes are checked at once with
+//NEON on the V5, or SSE2/AVX2 on a PC, and the rest a byte at a time.
+static inline size_t scan_text(const char* text, size_t len, bool writing) {
+  size_t i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const uint8x16_t quote = vdupq_n_u8('"');
+  const uint8x16_t backslash = vdupq_n_u8('\\');
+  const uint8x16_t slash = vdupq_n_u8('/');
+  //Signed, so bytes of 0x80 and up count as below a space too.
+  const int8x16_t space = vdupq_n_s8(' ');
+  for(; i + 16 <= len; i += 16) {
+    uint8x16_t block = vld1q_u8((const uint8_t*)text + i);
+    uint8x16_t hit = vorrq_u8(vceqq_u8(block, quote), vceqq_u8(block, backslash));
+    if(writing) {
+      hit = vorrq_u8(hit, vceqq_u8(block, slash));
+      hit = vorrq_u8(hit, vcltq_s8(vreinterpretq_s8_u8(block), space));
     }
-    ret += ']';
-    return ret;
+    //Narrows the mask to 4 bits a byte, so it fits in one register.
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+    if(mask) return i + (__builtin_ctzll(mask) >> 2);
   }
-  if(is_object()) {
-    std::string ret = "{";
-    bool loopRanOnce = false;
-    for(auto& obj: object_data_const()) {
-      if(loopRanOnce) ret += ',';
-      auto str = json().set_string(obj.first).to_string();
-      ret += str;
-      ret += ':';
-      ret += obj.second.to_string();
-      loopRanOnce = true;
+#else
+#if defined(__AVX2__)
+  const __m256i wideQuote = _mm256_set1_epi8('"');
+  const __m256i wideBackslash = _mm256_set1_epi8('\\');
+  const __m256i wideSlash = _mm256_set1_epi8('/');
+  const __m256i wideSpace = _mm256_set1_epi8(' ');
+  for(; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i*)(text + i));
+    __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(block, wideQuote), _mm256_cmpeq_epi8(block, wideBackslash));
+    if(writing) {
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, wideSlash));
+      hit = _mm256_or_si256(hit, _mm256_cmpgt_epi8(wideSpace, block));
     }
-    ret += '}';
-    return ret;
+    uint32_t mask = _mm256_movemask_epi8(hit);
+    if(mask) return i + __builtin_ctz(mask);
   }
-  throw std::runtime_error("Unknown object type");
+#endif
+#if defined(__SSE2__)
+  //With AVX2 this mops up what's left after the 32 byte blocks.
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i space = _mm_set1_epi8(' ');
+  for(; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)(text + i));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash));
+    if(writing) {
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, slash));
+      hit = _mm_or_si128(hit, _mm_cmplt_epi8(block, space));
+    }
+    uint32_t mask = _mm_movemask_epi8(hit);
+    if(mask) return i + __builtin_ctz(mask);
+  }
+#endif
+#endif
+  for(; i < len; i++) {
+    unsigned char c = text[i];
+    if(c == '"' || c == '\\') break;
+    if(writing && (c == '/' || c < 0x20 || c >= 0x80)) break;
+  }
+  return i;
 }
 
-json json::impl::parse(const std::string& data, int &idx) {
-  //Read until any of [, ", {, n, f, t, # is found.
-  char c;
-  skip_whitespace(data, idx);
-  c = data[idx];
-  if(c == '[') return parse_array(data, idx);
-  if(c == '"') return parse_string(data, idx);
-  if(c == '{') return parse_object(data, idx);
-  if(c == 'n') {
-    idx += 4;
-    return std::move(json().set_null());
-  }
-  if(c == 't') {
-    idx += 4;
-    return std::move(json().set_bool(true));
-  }
-  if(c == 'f') {
-    idx += 5;
-    return std::move(json().set_bool(false));
+// ----- Parsing -----
+
+struct json::impl::parser {
+  std::string_view data;
+  size_t idx = 0;
+  //When set, nodes and strings are put here instead of the heap.
+  json_arena* arena;
+  //Whether strings in the arena may point into data.
+  bool borrow = false;
+  //Holds strings that had escapes in them while they're decoded.
+  std::string unescaped;
+  //The first thing that went wrong, if anything has. Once it's set,
+  //peek() acts like the text has ended, so everything winds down.
+  json_parse_error error;
+  //Arrays and objects we're inside of, see json::MAX_DEPTH.
+  int depth = 0;
+
+  parser(std::string_view idata, json_arena* iarena): data(idata), arena(iarena) {
+    if(arena) {
+      auto& src = arena->source;
+      borrow = data.data() >= src.data() && data.data() + data.size() <= src.data() + src.size();
+    }
+  }
+  inline char peek() const { return idx < data.size() && !error ? data[idx] : 0; }
+  inline char next() { char c = peek(); idx++; return c; }
+  //Nothing here throws, failing just records what happened.
+  void fail(const char* what) {
+    if(!error) error = {what, idx};
+  }
+  //Makes an empty container json, in the arena if there is one.
+  json container(json_type kind);
+  //Fails if going into another container would be too deep.
+  bool nest() {
+    if(depth < json::MAX_DEPTH) return true;
+    fail("Nested too deep");
+    return false;
+  }
+  json value();
+  json array();
+  json object();
+  json string();
+  double number();
+  void literal(const char* word);
+  //Event parsing, for json::parse_events. These return false once
+  //the handler has asked to stop.
+  bool events(json_handler& handler);
+  bool array_events(json_handler& handler);
+  bool object_events(json_handler& handler);
+  void skip_whitespace();
+  //Reads a string, returning a view of its decoded text. It points
+  //right into data when there were no escapes, otherwise into unescaped.
+  std::string_view string_text();
+  void unescape();
+  //Reads the four hex digits of a unicode escape, with idx on the u.
+  //Leaves idx on the last digit.
+  bool hex_escape(uint32_t& codepoint);
+};
+
+json json::impl::parser::container(json_type kind) {
+  json ret;
+  if(arena) {
+    ret.pImpl = new (arena->alloc_cleanup(sizeof(impl), destroy)) impl(kind);
+    ret.in_arena = true;
+    ret.kind = kind;
+  } else {
+    ret.reset_impl(kind);
+  }
+  return ret;
+}
+
+json json::impl::parser::value() {
+  skip_whitespace();
+  char c = peek();
+  if(c == '[' || c == '{') {
+    if(!nest()) return json();
+    depth++;
+    json ret = c == '[' ? array() : object();
+    depth--;
+    return ret;
   }
+  if(c == '"') return string();
+  if(c == 'n') { literal("null"); return json(); }
+  if(c == 't') { literal("true"); return json(true); }
+  if(c == 'f') { literal("false"); return json(false); }
   //JSON numbers may not begin with a '.'
-  if(c == '-' || ('0' <= c && c <= '9')) {
-    const char* dat = data.c_str() + idx;
-    char* end;
-    double ret = strtod(dat, &end);
-    idx += end - dat;
-    return std::move(json().set_number(ret));
+  if(c == '-' || ('0' <= c && c <= '9')) return json(number());
+  fail("Failed to find JSON object");
+  return json();
+}
+
+void json::impl::parser::literal(const char* word) {
+  size_t len = strlen(word);
+  if(idx + len > data.size() || data.compare(idx, len, word) != 0) {
+    fail("Unknown literal");
+    return;
+  }
+  idx += len;
+}
+
+double json::impl::parser::number() {
+  //strtod needs a terminated string, and data might not be.
+  char buf[64];
+  size_t len = 0;
+  char c;
+  while((c = peek()) && (('0' <= c && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) {
+    if(len == sizeof(buf) - 1) {
+      fail("Number too long");
+      return 0;
+    }
+    buf[len++] = c;
+    idx++;
   }
-  throw std::runtime_error("Failed to find JSON object at column " + std::to_string(idx));
+  buf[len] = 0;
+  char* end;
+  double ret = strtod(buf, &end);
+  if(end != buf + len) fail("Malformed number");
+  return ret;
 }
 
-json json::impl::parse_array(const std::string& data, int& idx) {
-  auto ret = std::move(json().set_array({}));
+json json::impl::parser::array() {
+  auto ret = container(JARRAY);
+  auto& values = ret.pImpl->values;
+  values.reserve(4);
   idx++;
+  skip_whitespace();
+  if(peek() == ']') { idx++; return ret; }
+  char c;
   do {
-    if(data[idx] == ']') { idx++; break; }
-    ret.array_data().push_back(parse(data, idx));
-    skip_whitespace(data, idx);
-  } while(data[idx++] == ',');
+    values.push_back(value());
+    skip_whitespace();
+  } while((c = next()) == ',');
   //We ended the array, it better have been with a ].
-  if(data[idx - 1] != ']') throw std::runtime_error("Expected ] not " + std::to_string(data[idx - 1]));
+  if(c != ']') fail("Expected ]");
   return ret;
 }
 
-json json::impl::parse_object(const std::string& data, int& idx) {
-  auto ret = std::move(json().set_object({}));
+json json::impl::parser::object() {
+  auto ret = container(JOBJECT);
+  auto& pairs = ret.pImpl->pairs;
+  pairs.reserve(4);
   idx++;
+  skip_whitespace();
+  if(peek() == '}') { idx++; return ret; }
+  char c;
   do {
-    skip_whitespace(data, idx);
-    if(data[idx] == '}') { idx++; break; }
-    auto key = parse(data, idx).get_string();
-    skip_whitespace(data, idx);
-    if(data[idx++] != ':') throw std::runtime_error("No colon after key.");
-    auto val = parse(data, idx);
-    skip_whitespace(data, idx);
-    ret.object_data().push_back({key, std::move(val)});
-  } while(data[idx++] == ',');
+    skip_whitespace();
+    if(peek() != '"') {
+      fail("Expected a key");
+      return ret;
+    }
+    auto key = json_key::from_input(string_text());
+    skip_whitespace();
+    if(peek() != ':') {
+      fail("No colon after key");
+      return ret;
+    }
+    idx++;
+    pairs.emplace_back(std::move(key), value());
+    skip_whitespace();
+  } while((c = next()) == ',');
   //We ended the object, it better have been with a }.
-  if(data[idx - 1] != '}') throw std::runtime_error("Expected } not " + std::to_string(data[idx - 1]) + " on original text of " + data);
+  if(c != '}') fail("Expected }");
+  //Indexed now, while nothing else can see it. See find_key.
+  ret.pImpl->update_index();
   return ret;
 }
 
-void json::impl::skip_whitespace(const std::string& data, int& idx) {
+json json::impl::parser::string() {
+  auto text = string_text();
+  json ret;
+  if(arena) {
+    //Text pointing into the arena's own source is fine as is.
+    //Anything else has to be moved somewhere that'll last.
+    if(!borrow || text.data() == unescaped.data()) text = arena->copy(text);
+    ret.pImpl = new (arena->alloc(sizeof(impl))) impl(text);
+    ret.in_arena = true;
+    ret.kind = JSTRING;
+  } else {
+    ret.set_string(std::string(text));
+  }
+  return ret;
+}
+
+void json::impl::parser::skip_whitespace() {
   char c;
-  while((c = data[idx]) == ' ' || c == 0x0D || c == 0x0A || c == 0x09) idx++;
+  while((c = peek()) == ' ' || c == 0x0D || c == 0x0A || c == 0x09) idx++;
+}
+
+std::string_view json::impl::parser::string_text() {
+  size_t begin = ++idx;
+  //Escape-free strings, which is nearly all of them, need no copying at all.
+  size_t end = begin + scan_text(data.data() + begin, data.size() - begin, false);
+  if(end == data.size()) {
+    fail("Unterminated string");
+    return std::string_view();
+  }
+  if(data[end] == '"') {
+    idx = end + 1;
+    return data.substr(begin, end - begin);
+  }
+  unescaped.assign(data.data() + begin, end - begin);
+  idx = end;
+  unescape();
+  return unescaped;
 }
 
 static int parse_hex(char c) {
   if('0' <= c && c <= '9') return 0 + (c - '0');
-  if('a' <= c && c <= 'z') return 10 + (c - 'a');
-  if('A' <= c && c <= 'Z') return 10 + (c - 'A');
-  return 0;
+  if('a' <= c && c <= 'f') return 10 + (c - 'a');
+  if('A' <= c && c <= 'F') return 10 + (c - 'A');
+  return -1;
 }
 
-json json::impl::parse_string(const std::string& data, int& idx) {
-  idx++;
-  uint32_t lastSurrogatePair = 0;
-  std::string ret;
+bool json::impl::parser::hex_escape(uint32_t& codepoint) {
+  if(idx + 4 >= data.size()) {
+    fail("Unterminated string");
+    return false;
+  }
+  codepoint = 0;
+  for(int i = 0; i < 4; i++) {
+    int digit = parse_hex(data[++idx]);
+    if(digit < 0) {
+      fail("Bad \\u escape");
+      return false;
+    }
+    codepoint = codepoint << 4 | digit;
+  }
+  return true;
+}
+
+//Decodes the rest of a string from idx onto unescaped.
+void json::impl::parser::unescape() {
+  auto& ret = unescaped;
   unsigned char c;
-  while((c = data[idx]) != '"') {
+  while((c = peek()) != '"') {
+    if(idx >= data.size() || error) {
+      fail("Unterminated string");
+      return;
+    }
     if(c == '\\') {
-      c = data[++idx];
-      if(c == '\\' || c == '/' || c == '"') {
-        ret.push_back(c);
-        idx++;
-        continue;
-      }
-      if(c == 'b') { ret.push_back(0x8); continue; }
-      if(c == 'f') { ret.push_back(0xc); continue; }
-      if(c == 'n') { ret.push_back(0xa); continue; }
-      if(c == 'r') { ret.push_back(0xd); continue; }
-      if(c == 't') { ret.push_back(0x9); continue; }
-      if(c == 'u') {
-        uint32_t codepoint = 0;
-        for(int i = 0; i < 4; i++) {
-          codepoint <<= 4;
-          codepoint |= parse_hex(data[++idx]);
-        }
-        //High Surrogate Pair
+      idx++;
+      c = peek();
+      if(c == '\\' || c == '/' || c == '"') ret.push_back(c);
+      else if(c == 'b') ret.push_back(0x8);
+      else if(c == 'f') ret.push_back(0xc);
+      else if(c == 'n') ret.push_back(0xa);
+      else if(c == 'r') ret.push_back(0xd);
+      else if(c == 't') ret.push_back(0x9);
+      else if(c == 'u') {
+        uint32_t codepoint;
+        if(!hex_escape(codepoint)) return;
         if(0xD800 <= codepoint && codepoint < 0xDC00) {
-          lastSurrogatePair = codepoint;
-          idx++;
-          continue;
-        }
-        //Low Surrogate Pair
-        if(0xDC00 <= codepoint && codepoint < 0xDFFF) {
-          codepoint = codepoint & 0x3FF;
-          codepoint |= (lastSurrogatePair & 0x3FF) << 10;
-          codepoint += 0x10000;
+          //A high surrogate only makes a character with a low one right after it.
+          size_t high = idx;
+          uint32_t low = 0;
+          if(data.substr(idx + 1, 2) == "\\u") {
+            idx += 2;
+            if(!hex_escape(low)) return;
+          }
+          if(0xDC00 <= low && low < 0xE000) {
+            codepoint = 0x10000 + ((codepoint & 0x3FF) << 10) + (low & 0x3FF);
+          } else {
+            idx = high;
+            codepoint = 0xFFFD;
+          }
+        } else if(0xDC00 <= codepoint && codepoint < 0xE000) {
+          codepoint = 0xFFFD;
         }
         //Now, to encode this as UTF8!
         if(codepoint < (1 << 7)) {
@@ -237,115 +981,573 @@ json json::impl::parse_string(const std::string& data, int& idx) {
         }
       }
     } else {
-      ret.push_back(c);
+      //Copy everything up to the next escape (or the end) in one go.
+      size_t run = scan_text(data.data() + idx, data.size() - idx, false);
+      ret.append(data.data() + idx, run);
+      idx += run;
+      continue;
     }
     idx++;
   }
   idx++;
-  return std::move(json().set_string(ret));
 }
 
-std::string json::impl::utf8_to_16_escaped(const std::string& text) {
-  std::stringstream ret; ret << "\"";
-  for(int i = 0; i < text.size(); i++) {
+bool json::impl::parser::events(json_handler& handler) {
+  skip_whitespace();
+  char c = peek();
+  if(c == '[' || c == '{') {
+    if(!nest()) return false;
+    depth++;
+    bool ret = c == '[' ? array_events(handler) : object_events(handler);
+    depth--;
+    return ret;
+  }
+  if(c == '"') {
+    auto text = string_text();
+    return !error && handler.string(text);
+  }
+  if(c == 'n') { literal("null"); return !error && handler.null_value(); }
+  if(c == 't') { literal("true"); return !error && handler.boolean(true); }
+  if(c == 'f') { literal("false"); return !error && handler.boolean(false); }
+  if(c == '-' || ('0' <= c && c <= '9')) {
+    double val = number();
+    return !error && handler.number(val);
+  }
+  fail("Failed to find JSON object");
+  return false;
+}
+
+bool json::impl::parser::array_events(json_handler& handler) {
+  if(!handler.begin_array()) return false;
+  idx++;
+  skip_whitespace();
+  if(peek() == ']') { idx++; return handler.end_array(); }
+  char c;
+  do {
+    if(!events(handler)) return false;
+    skip_whitespace();
+  } while((c = next()) == ',');
+  if(c != ']') {
+    fail("Expected ]");
+    return false;
+  }
+  return handler.end_array();
+}
+
+bool json::impl::parser::object_events(json_handler& handler) {
+  if(!handler.begin_object()) return false;
+  idx++;
+  skip_whitespace();
+  if(peek() == '}') { idx++; return handler.end_object(); }
+  char c;
+  do {
+    skip_whitespace();
+    if(peek() != '"') {
+      fail("Expected a key");
+      return false;
+    }
+    auto key = string_text();
+    if(error || !handler.key(key)) return false;
+    skip_whitespace();
+    if(peek() != ':') {
+      fail("No colon after key");
+      return false;
+    }
+    idx++;
+    if(!events(handler)) return false;
+    skip_whitespace();
+  } while((c = next()) == ',');
+  if(c != '}') {
+    fail("Expected }");
+    return false;
+  }
+  return handler.end_object();
+}
+
+bool json::parse_events(std::string_view data, json_handler& handler) {
+  json_parse_error error;
+  bool ret = try_parse_events(data, handler, error);
+  if(error) throw std::runtime_error(error.message());
+  return ret;
+}
+
+bool json::try_parse_events(std::string_view data, json_handler& handler, json_parse_error& error) {
+  json::impl::parser p(data, nullptr);
+  bool ret = p.events(handler);
+  error = p.error;
+  return ret && !error;
+}
+
+// ----- json_stream -----
+
+struct json_stream::state {
+  //What the next character is expected to be part of.
+  enum expecting {
+    VALUE,        //Any value
+    VALUE_OR_END, //A value or ], right after a [
+    KEY,          //A key string, after a comma
+    KEY_OR_END,   //A key string or }, right after a {
+    COLON,        //The : after a key
+    AFTER_VALUE,  //A comma or the end of the container
+    STRING,       //Inside of a string, which goes into token
+    NUMBER,       //Inside of a number, which goes into token
+    LITERAL,      //Inside of null/true/false, which goes into token
+    DONE          //The whole value has been read
+  } at = VALUE;
+  //A container that hasn't been closed yet.
+  struct frame {
+    json value;
+    std::string key;
+  };
+  std::vector<frame> stack;
+  //The string/number/literal being read, which might span chunks.
+  std::string token;
+  bool escaped = false;
+  bool stringIsKey = false;
+  json result;
+  size_t column = 0;
+
+  [[noreturn]] void fail(const std::string& what) {
+    throw std::runtime_error(what + " at column " + std::to_string(column));
+  }
+  void emit(json val);
+  void close(char c);
+  void begin_value(char c);
+  //Finishes a number or literal, if one was being read.
+  void end_token();
+};
+
+void json_stream::state::emit(json val) {
+  if(stack.empty()) {
+    result = std::move(val);
+    at = DONE;
+    return;
+  }
+  auto& top = stack.back();
+  if(top.value.is_array()) top.value.pImpl->values.push_back(std::move(val));
+  else top.value.pImpl->pairs.emplace_back(json_key::from_input(top.key), std::move(val));
+  at = AFTER_VALUE;
+}
+
+void json_stream::state::close(char c) {
+  if(stack.empty() || (c == ']') != stack.back().value.is_array()) fail(std::string("Unexpected ") + c);
+  json done = std::move(stack.back().value);
+  stack.pop_back();
+  if(done.is_object()) done.pImpl->update_index();
+  emit(std::move(done));
+}
+
+void json_stream::state::begin_value(char c) {
+  if(c == '{' || c == '[') {
+    //The stack here is on the heap, but what comes out still has to be
+    //walked and freed by recursing, so it's held to the same limit.
+    if(stack.size() == json::MAX_DEPTH) fail("Nested too deep");
+    stack.emplace_back();
+    stack.back().value.reset_impl(c == '{' ? JOBJECT : JARRAY);
+    at = c == '{' ? KEY_OR_END : VALUE_OR_END;
+  } else if(c == '"') {
+    token.assign(1, c);
+    stringIsKey = false;
+    at = STRING;
+  } else if(c == '-' || ('0' <= c && c <= '9')) {
+    token.assign(1, c);
+    at = NUMBER;
+  } else if('a' <= c && c <= 'z') {
+    token.assign(1, c);
+    at = LITERAL;
+  } else {
+    fail("Failed to find JSON object");
+  }
+}
+
+void json_stream::state::end_token() {
+  if(at == NUMBER) {
+    json::impl::parser reader(token, nullptr);
+    double val = reader.number();
+    if(reader.error) fail(reader.error.what);
+    emit(json(val));
+  } else if(at == LITERAL) {
+    if(token == "null") emit(json());
+    else if(token == "true") emit(json(true));
+    else if(token == "false") emit(json(false));
+    else fail("Unknown literal " + token);
+  }
+}
+
+json_stream::json_stream(): st(new state) {}
+json_stream::json_stream(json_stream&& toBeMoved) = default;
+json_stream& json_stream::operator=(json_stream&& toBeMoved) = default;
+json_stream::~json_stream() = default;
+
+void json_stream::feed(std::string_view chunk) {
+  auto& s = *st;
+  for(size_t i = 0; i < chunk.size(); i++, s.column++) {
+    char c = chunk[i];
+    if(s.at == state::STRING) {
+      //Copy everything up to the closing quote in one go.
+      size_t end = i;
+      while(end < chunk.size() && (s.escaped || chunk[end] != '"')) {
+        s.escaped = !s.escaped && chunk[end] == '\\';
+        end++;
+      }
+      s.token.append(chunk.data() + i, end - i);
+      s.column += end - i;
+      i = end;
+      if(i == chunk.size()) break;
+      s.token += '"';
+      //text might point into the parser, so it has to stay around.
+      json::impl::parser unescaper(s.token, nullptr);
+      auto text = unescaper.string_text();
+      if(unescaper.error) s.fail(unescaper.error.what);
+      if(s.stringIsKey) {
+        s.stack.back().key.assign(text.data(), text.size());
+        s.at = state::COLON;
+      } else {
+        s.emit(json(std::string(text)));
+      }
+      continue;
+    }
+    if(s.at == state::NUMBER || s.at == state::LITERAL) {
+      bool partOfToken = s.at == state::NUMBER
+        ? ('0' <= c && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'
+        : 'a' <= c && c <= 'z';
+      if(partOfToken) {
+        s.token += c;
+        continue;
+      }
+      s.end_token();
+    }
+    if(c == ' ' || c == 0x0D || c == 0x0A || c == 0x09) continue;
+    switch(s.at) {
+      case state::VALUE_OR_END:
+        if(c == ']') { s.close(c); break; }
+        s.begin_value(c);
+        break;
+      case state::VALUE:
+        s.begin_value(c);
+        break;
+      case state::KEY_OR_END:
+        if(c == '}') { s.close(c); break; }
+        //Falls through
+      case state::KEY:
+        if(c != '"') s.fail("Expected a key");
+        s.token.assign(1, c);
+        s.stringIsKey = true;
+        s.at = state::STRING;
+        break;
+      case state::COLON:
+        if(c != ':') s.fail("No colon after key");
+        s.at = state::VALUE;
+        break;
+      case state::AFTER_VALUE:
+        if(c == ',') s.at = s.stack.back().value.is_array() ? state::VALUE : state::KEY;
+        else if(c == ']' || c == '}') s.close(c);
+        else s.fail(std::string("Unexpected ") + c);
+        break;
+      case state::DONE:
+        //Like json::parse, whatever comes after the value is ignored.
+        return;
+      default:
+        break;
+    }
+  }
+}
+
+bool json_stream::done() const {
+  return st->at == state::DONE;
+}
+
+json json_stream::finish() {
+  auto& s = *st;
+  //A number at the very end has nothing after it to end it.
+  if(s.stack.empty()) s.end_token();
+  if(s.at != state::DONE) s.fail("Incomplete JSON");
+  json ret = std::move(s.result);
+  st.reset(new state);
+  return ret;
+}
+
+// ----- json_fields -----
+
+json_fields::json_fields(std::initializer_list<const char*> ikeys) {
+  if(ikeys.size() > MAX_FIELDS) throw std::runtime_error("Too many fields");
+  for(auto key: ikeys) keys[count++] = key;
+}
+
+bool json_fields::has(int field) const {
+  return field < count && found[field];
+}
+
+double json_fields::get(int field) const {
+  if(!has(field)) throw std::runtime_error(std::string("Missing field ") + keys[field]);
+  return values[field];
+}
+
+bool json_fields::begin_object() { depth++; return true; }
+bool json_fields::end_object() { depth--; return true; }
+bool json_fields::begin_array() { depth++; return true; }
+bool json_fields::end_array() { depth--; return true; }
+
+bool json_fields::key(std::string_view key) {
+  current = -1;
+  if(depth != 1) return true;
+  for(int i = 0; i < count; i++) {
+    if(key == keys[i]) {
+      current = i;
+      break;
+    }
+  }
+  return true;
+}
+
+bool json_fields::number(double val) {
+  if(depth == 1 && current >= 0) {
+    values[current] = val;
+    found[current] = true;
+  }
+  return true;
+}
+
+bool json_fields::boolean(bool val) {
+  return number(val ? 1 : 0);
+}
+
+std::string json_parse_error::message() const {
+  return std::string(what ? what : "No error") + " at column " + std::to_string(offset);
+}
+
+json json::parse(std::string_view data) {
+  json_parse_error error;
+  json ret = try_parse(data, error);
+  if(error) throw std::runtime_error(error.message());
+  return ret;
+}
+
+json json::parse(std::string_view data, json_arena& arena) {
+  json_parse_error error;
+  json ret = try_parse(data, arena, error);
+  if(error) throw std::runtime_error(error.message());
+  return ret;
+}
+
+json json::try_parse(std::string_view data, json_parse_error& error) {
+  json::impl::parser p(data, nullptr);
+  json ret = p.value();
+  error = p.error;
+  if(error) ret.set_null();
+  return ret;
+}
+
+json json::try_parse(std::string_view data, json_arena& arena, json_parse_error& error) {
+  json::impl::parser p(data, &arena);
+  json ret = p.value();
+  error = p.error;
+  if(error) ret.set_null();
+  return ret;
+}
+
+//Reads the UTF-8 character at the start of text, returning its length,
+//or 0 if it's cut off, overlong, a surrogate, or past U+10FFFF.
+static size_t decode_utf8(const unsigned char* text, size_t len, uint32_t& codepoint) {
+  unsigned int byte = text[0];
+  size_t charLen;
+  uint32_t min;
+  if(byte >= 0xC2 && byte < 0xE0) { charLen = 2; min = 0x80; codepoint = byte & 0x1F; }
+  else if(byte >= 0xE0 && byte < 0xF0) { charLen = 3; min = 0x800; codepoint = byte & 0xF; }
+  else if(byte >= 0xF0 && byte < 0xF5) { charLen = 4; min = 0x10000; codepoint = byte & 0x7; }
+  else return 0;
+  if(charLen > len) return 0;
+  for(size_t k = 1; k < charLen; k++) {
+    if((text[k] & 0xC0) != 0x80) return 0;
+    codepoint = codepoint << 6 | (text[k] & 0x3F);
+  }
+  if(codepoint < min || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint < 0xE000)) return 0;
+  return charLen;
+}
+
+//Appends \uXXXX onto out.
+static void append_u_escape(uint32_t codepoint, std::string& out) {
+  static const char hex[] = "0123456789abcdef";
+  char esc[6] = {'\\', 'u',
+    hex[(codepoint >> 12) & 0xF], hex[(codepoint >> 8) & 0xF],
+    hex[(codepoint >> 4) & 0xF], hex[codepoint & 0xF]};
+  out.append(esc, 6);
+}
+
+void json::impl::utf8_to_16_escaped(std::string_view text, std::string& out) {
+  out += '"';
+  for(size_t i = 0; i < text.size(); i++) {
+    //Plain text goes straight through, only what's left needs a look.
+    size_t run = scan_text(text.data() + i, text.size() - i, true);
+    if(run) {
+      out.append(text.data() + i, run);
+      i += run;
+      if(i == text.size()) break;
+    }
     unsigned int byte = (unsigned char)text[i];
     if(byte < (1 << 7)) {
-      if(byte == 0x8) ret << "\\b";
-      else if(byte == 0xc) ret << "\\f";
-      else if(byte == 0xa) ret << "\\n";
-      else if(byte == 0xd) ret << "\\r";
-      else if(byte == 0x9) ret << "\\t";
-      else if(byte == '"') ret << "\\\"";
-      else if(byte == '/') ret << "\\/";
-      else if(byte == '\\') ret << "\\\\";
-      else if(byte < 32) ret << "\\u00" << std::hex << std::setfill('0') << std::setw(2) << (int)byte;
-      else ret << (char)byte;
-    } else if(byte < 0xE0) {
-      //11 bits, ends at U+07FF
-      int32_t codepoint = 0;
-      codepoint |= ((unsigned char)text[i++] & 0x1F) << 6;
-      codepoint |= ((unsigned char)text[i  ] & 0x3F) << 0;
-      ret << "\\u";
-      ret << std::hex << std::setfill('0') << std::setw(4) << codepoint;
-    } else if(byte < 0xF0) {
-      //16 bits, ends at U+FFFF
-      int32_t codepoint = 0;
-      codepoint |= ((unsigned char)text[i++] & 0xF) << 12;
-      codepoint |= ((unsigned char)text[i++] & 0x3F) << 6;
-      codepoint |= ((unsigned char)text[i  ] & 0x3F) << 0;
-      ret << "\\u";
-      ret << std::hex << std::setfill('0') << std::setw(4) << codepoint;
+      if(byte == 0x8) out += "\\b";
+      else if(byte == 0xc) out += "\\f";
+      else if(byte == 0xa) out += "\\n";
+      else if(byte == 0xd) out += "\\r";
+      else if(byte == 0x9) out += "\\t";
+      else if(byte == '"') out += "\\\"";
+      else if(byte == '/') out += "\\/";
+      else if(byte == '\\') out += "\\\\";
+      else if(byte < 32) append_u_escape(byte, out);
+      else out += (char)byte;
+      continue;
+    }
+    uint32_t codepoint;
+    size_t charLen = decode_utf8((const unsigned char*)text.data() + i, text.size() - i, codepoint);
+    //Bytes that aren't part of a proper character each get a replacement
+    //character, so what's written always reads back the same.
+    if(!charLen) {
+      append_u_escape(0xFFFD, out);
+      continue;
+    }
+    i += charLen - 1;
+    if(codepoint < 0x10000) {
+      append_u_escape(codepoint, out);
     } else {
-      //21 bits, ends at U+10FFFF
-      uint32_t codepoint = 0;
-      codepoint |= ((unsigned char)text[i++] & 0x7) << 18;
-      codepoint |= ((unsigned char)text[i++] & 0x3F) << 12;
-      codepoint |= ((unsigned char)text[i++] & 0x3F) << 6;
-      codepoint |= ((unsigned char)text[i  ] & 0x3F) << 0;
-      if(codepoint < 0x10000) {
-        ret << "\\u";
-        ret << std::hex << std::setfill('0') << std::setw(4) << codepoint;
-      } else {
-        codepoint -= 0x10000;
-        ret << "\\u";
-        ret << std::hex << std::setfill('0') << std::setw(4) << (0xD800 + (codepoint >> 10));
-        ret << "\\u";
-        ret << std::hex << std::setfill('0') << std::setw(4) << (0xDC00 + (codepoint & 0x3FF));
-      }
+      codepoint -= 0x10000;
+      append_u_escape(0xD800 + (codepoint >> 10), out);
+      append_u_escape(0xDC00 + (codepoint & 0x3FF), out);
     }
   }
-  ret << '"';
-  return ret.str();
+  out += '"';
 }
 
-json::json(const json& orig):
-kind(orig.kind),
-pImpl(std::make_unique<json::impl>(*orig.pImpl)),
-str_value(orig.str_value),
-dbl_value(orig.dbl_value),
-bool_value(orig.bool_value)
-{}
+json::json(const json& orig): kind(orig.kind) {
+  if(!has_impl()) {
+    dbl_value = orig.dbl_value;
+  } else if(orig.in_arena) {
+    //The arena might not outlive us, so this needs a real copy.
+    pImpl = new impl(*orig.pImpl);
+  } else {
+    pImpl = orig.pImpl;
+    pImpl->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
 
-json& json::operator=(const json& orig) {
-  kind = orig.kind;
-  pImpl = std::make_unique<json::impl>(*orig.pImpl);
-  str_value = orig.str_value;
-  dbl_value = orig.dbl_value;
-  bool_value = orig.bool_value;
-  return *this;
+json json::shallow_copy() const {
+  if(!in_arena) return *this;
+  json ret;
+  ret.kind = kind;
+  ret.pImpl = pImpl;
+  ret.in_arena = true;
+  return ret;
 }
 
-json::~json() = default;
+json& json::operator=(const json& orig) {
+  if(this == &orig) return *this;
+  //Copy first, orig might live inside of us.
+  json copy(orig);
+  return *this = std::move(copy);
+}
 
-json::json(json&& bruh) = default;
-json& json::operator=(json&& bruh) = default;
+json::json(json&& bruh) noexcept: kind(bruh.kind), in_arena(bruh.in_arena), dbl_value(bruh.dbl_value) {
+  if(has_impl()) pImpl = bruh.pImpl;
+  bruh.kind = JNULL;
+  bruh.in_arena = false;
+}
 
+json& json::operator=(json&& bruh) noexcept {
+  if(this == &bruh) return *this;
+  //Take bruh's value before releasing, bruh might live inside of us.
+  json_type newKind = bruh.kind;
+  bool newInArena = bruh.in_arena;
+  double newValue = bruh.dbl_value;
+  impl* newImpl = bruh.pImpl;
+  bruh.kind = JNULL;
+  bruh.in_arena = false;
+  if(has_impl()) release();
+  kind = newKind;
+  in_arena = newInArena;
+  if(has_impl()) pImpl = newImpl;
+  else dbl_value = newValue;
+  return *this;
+}
 
-json::json(): pImpl(std::make_unique<json::impl>()) {}
-json::json(nullptr_t): pImpl(std::make_unique<json::impl>()) { set_null(); }
-json::json(double val): pImpl(std::make_unique<json::impl>()) { set_number(val); }
-json::json(int val): pImpl(std::make_unique<json::impl>()) { set_number(val); }
-json::json(bool val): pImpl(std::make_unique<json::impl>()) { set_bool(val); }
-json::json(std::string val): pImpl(std::make_unique<json::impl>()) { set_string(val); }
-json::json(const char* val): pImpl(std::make_unique<json::impl>()) { set_string(val); }
-json::json(std::initializer_list<json> vals): pImpl(std::make_unique<json::impl>()) { set_array(std::move(vals)); }
-json::json(std::initializer_list<std::pair<std::string, json>> vals): pImpl(std::make_unique<json::impl>()) { set_object(std::move(vals)); }
+json::json(std::string val): json() { set_string(std::move(val)); }
+json::json(const char* val): json() { set_string(val); }
+json::json(std::initializer_list<json> vals): json() { set_array(std::move(vals)); }
+json::json(std::initializer_list<std::pair<std::string, json>> vals): json() { set_object(std::move(vals)); }
 
 json& json::operator[](const std::string& key) {
-  for(auto& pair: object_data()) {
-    if(pair.first == key) return pair.second;
-  }
-  object_data().insert(object_data().end(), {
-    {key, json()}
-  });
-  return (object_data().end() - 1)->second;
+  //Like JavaScript, indexing into null makes it an object.
+  if(is_null()) reset_impl(JOBJECT);
+  if(!is_object()) throw std::runtime_error("I am not an object");
+  auto& mine = own();
+  auto& pairs = mine.pairs;
+  //Interning it now means the search is just comparing pointers.
+  json_key interned(key);
+  size_t i = mine.find_key(interned, true);
+  if(i < pairs.size()) return pairs[i].second;
+  pairs.emplace_back(std::move(interned), json());
+  return pairs.back().second;
 }
 
 json& json::operator[](int key) {
   return array_data()[key];
 }
-std::vector<std::pair<std::string, json>>::iterator json::find(const std::string& key) {
-  return std::find_if(object_data().begin(), object_data().end(), [&](const std::pair<std::string, json>& kv) {
-    return key == kv.first;
-  });
-}
\ No newline at end of file
+std::vector<std::pair<json_key, json>>::iterator json::find(const std::string& key) {
+  if(!is_object()) throw std::runtime_error("I am not an object");
+  auto& mine = own();
+  size_t i = mine.find_key(std::string_view(key), false);
+  //The caller can rename the key through the iterator, like with
+  //object_data(), so the index can't be trusted after this.
+  mine.drop_index();
+  return mine.pairs.begin() + i;
+}
+
+// ----- json_table -----
+
+json_table::json_table(std::initializer_list<const char*> keys) {
+  for(auto key: keys) this->keys.push_back(key);
+  columns.resize(this->keys.size());
+}
+
+json_table::json_table(std::vector<json_key> keys): keys(std::move(keys)) {
+  columns.resize(this->keys.size());
+}
+
+void json_table::reserve(size_t rows) {
+  for(auto& column: columns) column.reserve(rows);
+}
+
+void json_table::add_row(std::initializer_list<double> row) {
+  if(row.size() != keys.size()) throw std::runtime_error("Row doesn't match the table's keys");
+  auto val = row.begin();
+  for(auto& column: columns) column.push_back(*val++);
+}
+
+void json_table::add_row(const double* row) {
+  for(auto& column: columns) column.push_back(*row++);
+}
+
+json json_table::to_rows() const {
+  json ret = json::array({});
+  auto& rows = ret.array_data();
+  rows.reserve(size());
+  for(size_t i = 0; i < size(); i++) {
+    json row = json::object({});
+    auto& pairs = row.object_data();
+    pairs.reserve(keys.size());
+    for(size_t k = 0; k < keys.size(); k++) {
+      pairs.emplace_back(keys[k], columns[k][i]);
+    }
+    rows.push_back(std::move(row));
+  }
+  return ret;
+}
+
+json json_table::to_columns(bool single) const {
+  json ret = json::object({});
+  auto& pairs = ret.object_data();
+  pairs.reserve(keys.size());
+  for(size_t k = 0; k < keys.size(); k++) {
+    pairs.emplace_back(keys[k], json::numbers(columns[k], single));
+  }
+  return ret;
+}
@@ -1,3 +1,4 @@
+#pragma once
 //Simple JSON implementation, not making use of templates or really anything special.
 //Unicode \u escapes are stored as UTF-8 bytes, no support for other encodings because
 //other encodings are wack.
@@ -6,61 +7,228 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <string_view>
 #include <stdexcept>
 #include <memory>
 
+//What went wrong in a failed parse, see json::try_parse.
+struct json_parse_error {
+  //Fixed text saying what went wrong, or null if nothing did.
+  const char* what = nullptr;
+  //How far into the text it went wrong.
+  size_t offset = 0;
+  inline explicit operator bool() const { return what != nullptr; }
+  //The same text parse() would have thrown.
+  std::string message() const;
+};
+
+//Receives serialized JSON text a piece at a time, see json::write.
+struct json_sink {
+  virtual void put(const char* text, size_t len) = 0;
+  virtual ~json_sink() = default;
+};
+
+//Callbacks for json::parse_events, which walks JSON text without making
+//any json values. Returning false from one stops the parse early.
+//Views passed in are only good until the callback returns.
+struct json_handler {
+  virtual bool null_value() { return true; }
+  virtual bool boolean(bool val) { return true; }
+  virtual bool number(double val) { return true; }
+  virtual bool string(std::string_view val) { return true; }
+  virtual bool begin_object() { return true; }
+  virtual bool key(std::string_view key) { return true; }
+  virtual bool end_object() { return true; }
+  virtual bool begin_array() { return true; }
+  virtual bool end_array() { return true; }
+  virtual ~json_handler() = default;
+};
+
+//A json_handler that picks numbers (and bools, as 1 or 0) out of
+//the top level of an object by key, for handlers that only need
+//a couple of fields. Fields are numbered in the order they were given.
+class json_fields: public json_handler {
+  static const int MAX_FIELDS = 8;
+  const char* keys[MAX_FIELDS];
+  double values[MAX_FIELDS];
+  bool found[MAX_FIELDS] = {};
+  int count = 0;
+  int depth = 0;
+  int current = -1;
+  public:
+  json_fields(std::initializer_list<const char*> keys);
+  bool has(int field) const;
+  //Throws if the field wasn't there.
+  double get(int field) const;
+
+  bool boolean(bool val) override;
+  bool number(double val) override;
+  bool begin_object() override;
+  bool key(std::string_view key) override;
+  bool end_object() override;
+  bool begin_array() override;
+  bool end_array() override;
+};
+
+//A bump allocator that parsed documents can live in, see json::parse.
+//Nodes and strings parsed into an arena are freed all at once when the
+//arena is destroyed, so the arena has to outlive them. Copying a json
+//out of an arena always makes a normal, independent, heap copy.
+class json_arena {
+  struct block;
+  struct cleanup;
+  block* blocks = nullptr;
+  cleanup* cleanups = nullptr;
+  char* pos = nullptr;
+  char* end = nullptr;
+  size_t nextBlock = 256;
+  size_t used = 0;
+  std::string source;
+  friend class json;
+  void* alloc(size_t size);
+  //Same as alloc, but destroy(ptr) gets run when the arena goes away.
+  void* alloc_cleanup(size_t size, void (*destroy)(void*));
+  public:
+  json_arena() = default;
+  json_arena(const json_arena&) = delete;
+  json_arena& operator=(const json_arena&) = delete;
+  ~json_arena();
+  //Keeps text alive as long as the arena, so parsed strings can point into it.
+  std::string_view adopt(std::string text);
+  std::string_view copy(std::string_view text);
+  inline size_t bytes_used() const { return used; }
+};
+
+//An object key. Short keys are interned: every key with the same text
+//points at one shared copy of it that's never freed, so a key is just a
+//pointer, and two interned keys are equal only if the pointers are.
+//Long keys, and any made once the table has filled up, own their text.
+class json_key {
+  public:
+  //Opaque, it's only public so json.cpp's intern table can hold them.
+  struct entry;
+  private:
+  const entry* ptr;
+  friend class json;
+  explicit json_key(const entry* made): ptr(made) {}
+  //input is for keys from parsed text, which only get so much of the table.
+  static const entry* intern(std::string_view text, uint32_t hash, bool input);
+  //The interned entry for text, or null if it's never been interned.
+  static const entry* find_interned(std::string_view text, uint32_t hash);
+  public:
+  json_key(std::string_view text);
+  //For keys read from input rather than written in code. Those share
+  //keys that are already interned, but only intern new ones while they're
+  //short and there haven't been too many, see json.cpp.
+  static json_key from_input(std::string_view text);
+  json_key(const std::string& text): json_key(std::string_view(text)) {}
+  json_key(const char* text): json_key(std::string_view(text)) {}
+  json_key(const json_key& orig);
+  json_key(json_key&& orig) noexcept;
+  json_key& operator=(const json_key& orig);
+  json_key& operator=(json_key&& orig) noexcept;
+  ~json_key();
+  std::string_view view() const;
+  inline operator std::string_view() const { return view(); }
+  inline std::string str() const { return std::string(view()); }
+  uint32_t hash() const;
+  bool operator==(const json_key& other) const;
+  inline bool operator!=(const json_key& other) const { return !(*this == other); }
+  //Text overloads, so comparing with a string doesn't make a key.
+  inline bool operator==(std::string_view text) const { return view() == text; }
+  inline bool operator==(const std::string& text) const { return view() == text; }
+  inline bool operator==(const char* text) const { return view() == text; }
+  inline bool operator!=(std::string_view text) const { return view() != text; }
+  inline bool operator!=(const std::string& text) const { return view() != text; }
+  inline bool operator!=(const char* text) const { return view() != text; }
+};
+
 enum json_type {
   JNULL, JNUM, JBOOL, JSTRING,
-  JARRAY, JOBJECT
+  JARRAY, JOBJECT,
+  //An array that only holds numbers, packed as plain doubles.
+  JNUMBERS
 };
 
 class json {
   struct impl;
+  friend class json_stream;
+  //Scalars live inline. Strings, arrays and objects keep their
+  //container in a single heap slot, pointed to by pImpl. Copies share
+  //that slot, and whichever one gets changed first makes its own.
   json_type kind;
-  std::unique_ptr<impl> pImpl;
-  std::string str_value;
-  double dbl_value;
-  bool bool_value;
+  //Set when pImpl belongs to a json_arena, which frees it instead of us.
+  bool in_arena = false;
+  union {
+    double dbl_value;
+    bool bool_value;
+    impl* pImpl;
+  };
+  inline bool has_impl() const { return kind >= JSTRING; }
+  //Frees pImpl (if there is one) and leaves this as a null.
+  void release();
+  //Makes pImpl a fresh, empty container of the given kind.
+  impl& reset_impl(json_type to);
+  //pImpl, after making sure no other json shares it, for changing it.
+  impl& own();
   public:
-  //These need to be defined, not declared, as default to make pImpl+unique_ptr work.
-  json(json&& toBeMoved);
-  json& operator=(json&& toBeMoved);
-  ~json();
+  json(json&& toBeMoved) noexcept;
+  json& operator=(json&& toBeMoved) noexcept;
+  inline ~json() { if(has_impl()) release(); }
   //Initialization Methods
   //You can make JSON values this way and nest them to make an awkward JSON literal.
-  json();
+  inline json(): kind(JNULL), dbl_value(0) {}
+  //Copying is cheap, the copy shares everything until one is changed.
+  //Copies of arena values are real copies though, since they have to
+  //outlive the arena.
   json(const json& orig);
   json& operator=(const json& orig);
+  //Copies without ever copying anything, even from an arena. The copy
+  //is only good while the arena is, so it's for things like Message
+  //that keep the arena alive themselves.
+  json shallow_copy() const;
 
-  inline json& set_null() { kind = JNULL; return *this; }
-  json(std::nullptr_t);
+  inline json& set_null() { if(has_impl()) release(); kind = JNULL; return *this; }
+  inline json(std::nullptr_t): json() {}
   inline bool is_null() const { return kind == JNULL; }
 
-  inline json& set_number(double val) { kind = JNUM; dbl_value = val; return *this; }
-  json(double val);
-  json(int val);
+  inline json& set_number(double val) { if(has_impl()) release(); kind = JNUM; dbl_value = val; return *this; }
+  inline json(double val): kind(JNUM), dbl_value(val) {}
+  inline json(int val): kind(JNUM), dbl_value(val) {}
   inline bool is_number() const { return kind == JNUM; }
   inline double get_number() const {
     if(!is_number()) throw std::runtime_error("I am not a number");
     return dbl_value;
   }
+  //The try_get_ versions return false instead of throwing, leaving out alone.
+  inline bool try_get_number(double& out) const {
+    if(!is_number()) return false;
+    out = dbl_value;
+    return true;
+  }
 
-  inline json& set_bool(bool val) { kind = JBOOL; bool_value = val; return *this; }
-  json(bool val);
+  inline json& set_bool(bool val) { if(has_impl()) release(); kind = JBOOL; bool_value = val; return *this; }
+  inline json(bool val): kind(JBOOL), bool_value(val) {}
   inline bool is_bool() const { return kind == JBOOL; }
   inline bool get_bool() const {
     if(!is_bool()) throw std::runtime_error("I am not a boolean");
     return bool_value;
   }
+  inline bool try_get_bool(bool& out) const {
+    if(!is_bool()) return false;
+    out = bool_value;
+    return true;
+  }
 
-  inline json& set_string(std::string val) { kind = JSTRING; str_value = val; return *this; }
+  json& set_string(std::string val);
   json(std::string val);
   json(const char* val);
   inline bool is_string() const { return kind == JSTRING; }
-  inline std::string get_string() const {
-    if(!is_string()) throw std::runtime_error("I am not a string");
-    return str_value;
-  }
+  std::string get_string() const;
+  //Same as get_string, without the copy. Only good while this json is.
+  std::string_view get_string_view() const;
+  bool try_get_string(std::string_view& out) const;
 
   json& set_array(std::initializer_list<json> vals);
   inline static json array(std::initializer_list<json> init) {
@@ -75,20 +243,118 @@ class json {
     return json(std::move(init));
   }
   inline bool is_object() const { return kind == JOBJECT; }
+
+  //Packed number arrays write out just like an array of numbers, but
+  //cost 8 bytes an element instead of a whole json each. With single
+  //set, they're written with float precision, which is plenty for graphs
+  //and a lot shorter. Parsing never makes these, it makes plain arrays.
+  json& set_numbers(std::vector<double> vals, bool single = false);
+  inline static json numbers(std::vector<double> vals, bool single = false) {
+    return json().set_numbers(std::move(vals), single);
+  }
+  inline bool is_numbers() const { return kind == JNUMBERS; }
+  //Whether a packed number array is written with float precision.
+  bool numbers_single() const;
   //Modification Methods
   //These will let you modify the JSON object.
   //Because I'm lazy, it just returns the
   //underlying vector/unordered_map to work on directly.
   std::vector<json>& array_data();
   const std::vector<json>& array_data_const() const;
-  std::vector<std::pair<std::string, json>>& object_data();
-  const std::vector<std::pair<std::string, json>>& object_data_const() const;
+  std::vector<std::pair<json_key, json>>& object_data();
+  const std::vector<std::pair<json_key, json>>& object_data_const() const;
+  std::vector<double>& numbers_data();
+  const std::vector<double>& numbers_data_const() const;
   json& operator[](const std::string& key);
   json& operator[](int key);
-  std::vector<std::pair<std::string, json>>::iterator find(const std::string& key);
+  //The pair for key, or the end of object_data() if there isn't one.
+  //Like object_data(), the key can be changed through it.
+  std::vector<std::pair<json_key, json>>::iterator find(const std::string& key);
+  //The value at key, or null if this isn't an object or doesn't have it.
+  //Unlike operator[] it never adds anything, so it works on a const json.
+  const json* try_get(std::string_view key) const;
   //Parsing
-  //This will populate the object with the data contained in the string.
-  //Helper functions parse each kind of JSON data.
-  static json parse(const std::string& data);
+  //This will make a json value from the JSON text in data. The arena
+  //version puts every node in arena. Strings without escapes point
+  //straight into data when data is the arena's adopt()ed text.
+  static json parse(std::string_view data);
+  static json parse(std::string_view data, json_arena& arena);
+  //Same as parse, but instead of throwing they fill in error and give
+  //back a null. Cheaper for text that's expected to be bad sometimes.
+  static json try_parse(std::string_view data, json_parse_error& error);
+  static json try_parse(std::string_view data, json_arena& arena, json_parse_error& error);
+  //Arrays and objects nested deeper than this fail to parse like any
+  //other bad text, in every parser here (CBOR tags count as a level).
+  //Parsing recurses, and tabu tasks have 32 KB stacks, so a line of
+  //[[[[ could otherwise run one out.
+  static const int MAX_DEPTH = 32;
+  //Walks data, calling handler for each piece instead of making a json.
+  //Returns false if the handler stopped it early.
+  static bool parse_events(std::string_view data, json_handler& handler);
+  //Also returns false, with error filled in, if data is malformed.
+  static bool try_parse_events(std::string_view data, json_handler& handler, json_parse_error& error);
+  //Serialization
+  //write appends this value onto the end of out in a single pass, so
+  //a buffer can be reused between calls. The sink version hands over
+  //the text in blocks as it is produced.
+  void write(std::string& out) const;
+  void write(json_sink& out) const;
+  static void write_string(std::string_view text, std::string& out);
+  //Shortest text that reads back as exactly val. format_number needs
+  //NUMBER_BUFFER_SIZE bytes at out, and returns the end of what it wrote.
+  static const int NUMBER_BUFFER_SIZE = 32;
+  static char* format_number(double val, char* out);
+  //Same, but the shortest text that reads back as the same float.
+  static char* format_float(float val, char* out);
+  static void write_number(double val, std::string& out);
   std::string to_string() const;
+  //Binary
+  //CBOR (RFC 8949) versions of write and parse, for when JSON text is
+  //too bulky. Packed number arrays go out as RFC 8746 typed arrays, so
+  //each number costs exactly 4 or 8 bytes. They come back as plain
+  //arrays, like they would from JSON text.
+  void write_cbor(std::string& out) const;
+  static json parse_cbor(std::string_view data);
+  static json try_parse_cbor(std::string_view data, json_parse_error& error);
+};
+
+//Samples that all have the same keys, like the ones sent to be graphed.
+//They can be written out the usual way, as an array of objects, or as
+//an object of columns ({"time":[...],"error":[...]}) that doesn't
+//repeat every key for every sample.
+class json_table {
+  std::vector<json_key> keys;
+  std::vector<std::vector<double>> columns;
+  public:
+  json_table(std::initializer_list<const char*> keys);
+  json_table(std::vector<json_key> keys);
+  void reserve(size_t rows);
+  //Values go in the same order as the keys.
+  void add_row(std::initializer_list<double> row);
+  //Same, with row pointing at one value per key.
+  void add_row(const double* row);
+  inline size_t size() const { return columns.empty() ? 0 : columns[0].size(); }
+  json to_rows() const;
+  //One packed number array per key, see json::set_numbers.
+  json to_columns(bool single = false) const;
+};
+
+//Parses JSON text that arrives in pieces, like file-transfer chunks.
+//Each feed() carries on from where the last one stopped, so text is
+//only ever looked at once and never has to be glued back together.
+class json_stream {
+  struct state;
+  std::unique_ptr<state> st;
+  public:
+  json_stream();
+  json_stream(json_stream&& toBeMoved);
+  json_stream& operator=(json_stream&& toBeMoved);
+  ~json_stream();
+  //Parses the next piece of text. Throws on malformed JSON.
+  void feed(std::string_view chunk);
+  //Whether a whole value has been read.
+  bool done() const;
+  //Takes the parsed value, after the last piece has been fed.
+  //Throws if the text so far isn't a whole value.
+  json finish();
 };
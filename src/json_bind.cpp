@@ -0,0 +1,221 @@
+#include "json_bind.hpp"
+
+// ----- Writing -----
+
+void json_write_bound(const void* obj, const json_binding& binding, std::string& out) {
+  out += '{';
+  for(size_t i = 0; i < binding.count; i++) {
+    auto& field = binding.fields[i];
+    if(i) out += ',';
+    json::write_string(field.key, out);
+    out += ':';
+    if(field.kind == JOBJECT) {
+      json_write_bound(field.member(const_cast<void*>(obj)), *field.nested, out);
+    } else if(field.kind == JBOOL) {
+      out += field.get(obj) ? "true" : "false";
+    } else {
+      json::write_number(field.get(obj), out);
+    }
+  }
+  out += '}';
+}
+
+void json_write_bound(const void* first, size_t stride, size_t count, const json_binding& binding, std::string& out) {
+  auto pos = (const char*)first;
+  out += '[';
+  for(size_t i = 0; i < count; i++) {
+    if(i) out += ',';
+    json_write_bound(pos, binding, out);
+    pos += stride;
+  }
+  out += ']';
+}
+
+json_table json_table_bound(const void* first, size_t stride, size_t count, const json_binding& binding) {
+  std::vector<json_key> keys;
+  std::vector<const json_bound_field*> columns;
+  for(size_t i = 0; i < binding.count; i++) {
+    auto& field = binding.fields[i];
+    if(field.kind == JOBJECT) continue;
+    keys.emplace_back(field.key);
+    columns.push_back(&field);
+  }
+  json_table ret(std::move(keys));
+  ret.reserve(count);
+  std::vector<double> row(columns.size());
+  auto pos = (const char*)first;
+  for(size_t i = 0; i < count; i++) {
+    for(size_t c = 0; c < columns.size(); c++) row[c] = columns[c]->get(pos);
+    ret.add_row(row.data());
+    pos += stride;
+  }
+  return ret;
+}
+
+// ----- Reading -----
+
+static const json_bound_field* find_field(const json_binding& binding, std::string_view key) {
+  for(size_t i = 0; i < binding.count; i++) {
+    if(binding.fields[i].key == key) return &binding.fields[i];
+  }
+  return nullptr;
+}
+
+const json_bound_field* json_read_bound(const json& val, void* obj, const json_binding& binding) {
+  if(!val.is_object()) return binding.count ? &binding.fields[0] : nullptr;
+  for(size_t i = 0; i < binding.count; i++) {
+    auto& field = binding.fields[i];
+    auto found = val.try_get(field.key);
+    if(!found) {
+      if(field.optional) continue;
+      return &field;
+    }
+    if(field.kind == JOBJECT) {
+      if(!found->is_object()) return &field;
+      auto bad = json_read_bound(*found, field.member(obj), *field.nested);
+      if(bad) return bad;
+    } else if(field.kind == JBOOL) {
+      bool flag;
+      if(!found->try_get_bool(flag)) return &field;
+      field.set(obj, flag);
+    } else {
+      double num;
+      if(!found->try_get_number(num)) return &field;
+      field.set(obj, num);
+    }
+  }
+  return nullptr;
+}
+
+namespace {
+
+//Fills in a bound struct from parse events. Each object being read has a
+//frame, with a bit per field for the ones that have been seen, so that
+//missing ones can be caught when the object closes. Values under keys
+//that aren't bound are skipped over.
+class bound_reader: public json_handler {
+  static const int MAX_DEPTH = 8;
+  struct frame {
+    void* obj;
+    const json_binding* binding;
+    uint32_t seen;
+    //The field of the outer object this one is the value of.
+    const json_bound_field* field;
+  };
+  frame frames[MAX_DEPTH];
+  int depth = 0;
+  //Field the next value is for, when it's a bound one.
+  const json_bound_field* current = nullptr;
+  //How deep into values that aren't being read, 0 when not in one.
+  int skipping = 0;
+  //Whether the last key wasn't bound, so its value gets skipped.
+  bool skipNext = false;
+  bool started = false;
+
+  bool wrong_value() {
+    if(skipping) return true;
+    if(skipNext) { skipNext = false; return true; }
+    if(!current) what = "Expected an object";
+    else what = "Field has the wrong type";
+    return false;
+  }
+
+  void mark(const json_bound_field* field) {
+    auto& top = frames[depth - 1];
+    top.seen |= 1u << (field - top.binding->fields);
+    current = nullptr;
+  }
+
+  public:
+  const char* what = nullptr;
+  bound_reader(void* obj, const json_binding& binding) {
+    frames[0] = {obj, &binding, 0, nullptr};
+  }
+
+  bool null_value() override { return wrong_value(); }
+  bool string(std::string_view) override { return wrong_value(); }
+
+  bool number(double val) override {
+    if(skipping || skipNext || !current || current->kind != JNUM) return wrong_value();
+    current->set(frames[depth - 1].obj, val);
+    mark(current);
+    return true;
+  }
+
+  bool boolean(bool val) override {
+    if(skipping || skipNext || !current || current->kind != JBOOL) return wrong_value();
+    current->set(frames[depth - 1].obj, val);
+    mark(current);
+    return true;
+  }
+
+  bool begin_array() override {
+    if(skipping || skipNext) {
+      skipNext = false;
+      skipping++;
+      return true;
+    }
+    return wrong_value();
+  }
+
+  bool end_array() override {
+    skipping--;
+    return true;
+  }
+
+  bool begin_object() override {
+    if(skipping || skipNext) {
+      skipNext = false;
+      skipping++;
+      return true;
+    }
+    if(!started) {
+      started = true;
+      depth = 1;
+      return true;
+    }
+    if(!current || current->kind != JOBJECT) return wrong_value();
+    if(depth == MAX_DEPTH) {
+      what = "Objects nested too deep";
+      return false;
+    }
+    auto& top = frames[depth - 1];
+    frames[depth++] = {current->member(top.obj), current->nested, 0, current};
+    current = nullptr;
+    return true;
+  }
+
+  bool key(std::string_view key) override {
+    if(skipping) return true;
+    current = find_field(*frames[depth - 1].binding, key);
+    skipNext = !current;
+    return true;
+  }
+
+  bool end_object() override {
+    if(skipping) {
+      skipping--;
+      return true;
+    }
+    auto& top = frames[--depth];
+    for(size_t i = 0; i < top.binding->count; i++) {
+      if(!(top.seen & (1u << i)) && !top.binding->fields[i].optional) {
+        what = "Missing a field";
+        return false;
+      }
+    }
+    if(depth) mark(top.field);
+    return true;
+  }
+};
+
+}
+
+bool json_try_read_bound(std::string_view text, void* obj, const json_binding& binding, json_parse_error& error) {
+  if(binding.count > 32) throw std::runtime_error("Too many fields to read");
+  bound_reader reader(obj, binding);
+  if(json::try_parse_events(text, reader, error)) return true;
+  //A parse that the reader stopped has no error of its own yet.
+  if(!error) error.what = reader.what ? reader.what : "Stopped reading";
+  return false;
+}
@@ -0,0 +1,122 @@
+#pragma once
+//Typed binding between plain structs and JSON, for the places where
+//building a json value just to copy fields in or out of it is waste.
+//A struct opts in by specialising json_bind with a list of its fields:
+//
+//  template<> struct json_bind<Position> {
+//    static constexpr json_bound_field fields[] = {
+//      json_field<&Position::time>("time"),
+//      json_field<&Position::disp>("disp"),
+//    };
+//    static constexpr json_binding binding = {fields, std::size(fields)};
+//  };
+//
+//Then json_write puts it straight onto the end of a string, and
+//json_read fills it in from parse events or from a json object.
+//The templates here only make the field list. Walking it is done by
+//the plain functions in json_bind.cpp, which is why this is kept out
+//of json.hpp.
+
+#include "json.hpp"
+#include <type_traits>
+#include <iterator>
+
+struct json_binding;
+
+//One member of a bound struct, made by json_field.
+struct json_bound_field {
+  std::string_view key;
+  //JNUM for numbers and enums, JBOOL, or JOBJECT for a struct that has
+  //its own binding.
+  json_type kind;
+  //Reads leave optional fields alone when they're missing.
+  bool optional;
+  //The struct is passed as void* so the walking code isn't a template.
+  //get and set are for JNUM and JBOOL, member and nested for JOBJECT.
+  double (*get)(const void* obj);
+  void (*set)(void* obj, double val);
+  void* (*member)(void* obj);
+  const json_binding* nested;
+};
+
+struct json_binding {
+  const json_bound_field* fields;
+  size_t count;
+};
+
+template<typename T> struct json_bind;
+
+template<typename P> struct json_member_of;
+template<typename C, typename M> struct json_member_of<M C::*> {
+  using owner = C;
+  using type = M;
+};
+
+template<auto Member>
+constexpr json_bound_field json_field(std::string_view key, bool optional = false) {
+  using C = typename json_member_of<decltype(Member)>::owner;
+  using M = typename json_member_of<decltype(Member)>::type;
+  if constexpr(std::is_same_v<M, bool>) {
+    return {key, JBOOL, optional,
+      [](const void* obj) -> double { return static_cast<const C*>(obj)->*Member; },
+      [](void* obj, double val) { static_cast<C*>(obj)->*Member = val != 0; },
+      nullptr, nullptr};
+  } else if constexpr(std::is_arithmetic_v<M> || std::is_enum_v<M>) {
+    return {key, JNUM, optional,
+      [](const void* obj) -> double { return (double)(static_cast<const C*>(obj)->*Member); },
+      [](void* obj, double val) { static_cast<C*>(obj)->*Member = (M)val; },
+      nullptr, nullptr};
+  } else {
+    return {key, JOBJECT, optional, nullptr, nullptr,
+      [](void* obj) -> void* { return &(static_cast<C*>(obj)->*Member); },
+      &json_bind<M>::binding};
+  }
+}
+
+// ----- Untyped walkers, in json_bind.cpp -----
+
+void json_write_bound(const void* obj, const json_binding& binding, std::string& out);
+void json_write_bound(const void* first, size_t stride, size_t count, const json_binding& binding, std::string& out);
+//The field that was missing or the wrong type, or null if none was.
+const json_bound_field* json_read_bound(const json& val, void* obj, const json_binding& binding);
+bool json_try_read_bound(std::string_view text, void* obj, const json_binding& binding, json_parse_error& error);
+//Number and bool fields become columns, nested structs are left out.
+json_table json_table_bound(const void* first, size_t stride, size_t count, const json_binding& binding);
+
+// ----- Typed wrappers -----
+
+template<typename T>
+inline void json_write(const T& val, std::string& out) {
+  json_write_bound(&val, json_bind<T>::binding, out);
+}
+
+//An array of objects, the same as json_table::to_rows would make.
+template<typename T>
+inline void json_write(const std::vector<T>& vals, std::string& out) {
+  json_write_bound(vals.data(), sizeof(T), vals.size(), json_bind<T>::binding, out);
+}
+
+//Fields missing from val keep whatever out already had. Returns false
+//if a field that isn't optional was missing or had the wrong type.
+template<typename T>
+inline bool json_try_read(const json& val, T& out) {
+  return !json_read_bound(val, &out, json_bind<T>::binding);
+}
+
+//Same, but throws saying which field was the problem.
+template<typename T>
+inline void json_read(const json& val, T& out) {
+  auto bad = json_read_bound(val, &out, json_bind<T>::binding);
+  if(bad) throw std::runtime_error("Missing or mistyped field " + std::string(bad->key));
+}
+
+//Reads straight from JSON text with parse events, no json is made.
+template<typename T>
+inline bool json_try_read(std::string_view text, T& out, json_parse_error& error) {
+  return json_try_read_bound(text, &out, json_bind<T>::binding, error);
+}
+
+template<typename T>
+inline json_table json_table_of(const std::vector<T>& vals) {
+  return json_table_bound(vals.data(), sizeof(T), vals.size(), json_bind<T>::binding);
+}
@@ -0,0 +1,381 @@
+//CBOR encoding for json values, see RFC 8949.
+//Whole numbers are sent as CBOR integers, other numbers as the smallest
+//float that holds them exactly, and NaN and infinity as null like in
+//JSON text. Packed number arrays are RFC 8746 typed
+//arrays (tag 85 for little endian floats, 86 for doubles), so they're
+//just their raw bytes. Typed arrays are read back as plain arrays of
+//numbers. Only definite lengths are written or read.
+
+#include "json.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+
+enum major_type {
+  UNSIGNED = 0, NEGATIVE = 1, BYTES = 2, TEXT = 3,
+  ARRAY = 4, MAP = 5, TAG = 6, SIMPLE = 7
+};
+
+const uint64_t TAG_FLOAT32_LE = 85;
+const uint64_t TAG_FLOAT64_LE = 86;
+//Most items an array or map makes room for before reading them.
+const uint64_t MAX_RESERVE = 64;
+
+//Writes a major type with its argument, in as few bytes as it fits in.
+void write_head(int major, uint64_t arg, std::string& out) {
+  char buf[9];
+  int len;
+  buf[0] = major << 5;
+  if(arg < 24) {
+    buf[0] |= arg;
+    len = 1;
+  } else if(arg <= 0xFF) {
+    buf[0] |= 24;
+    len = 2;
+  } else if(arg <= 0xFFFF) {
+    buf[0] |= 25;
+    len = 3;
+  } else if(arg <= 0xFFFFFFFF) {
+    buf[0] |= 26;
+    len = 5;
+  } else {
+    buf[0] |= 27;
+    len = 9;
+  }
+  for(int i = len - 1; i > 0; i--) {
+    buf[i] = arg & 0xFF;
+    arg >>= 8;
+  }
+  out.append(buf, len);
+}
+
+void write_big_endian(uint64_t bits, int bytes, std::string& out) {
+  char buf[8];
+  for(int i = bytes - 1; i >= 0; i--) {
+    buf[i] = bits & 0xFF;
+    bits >>= 8;
+  }
+  out.append(buf, bytes);
+}
+
+//Whether val can be cast to a float. Casting one that's out of range
+//is undefined. False for NaN too.
+bool fits_float(double val) {
+  return std::fabs(val) <= FLT_MAX;
+}
+
+void write_number(double val, std::string& out) {
+  //JSON text has no NaN or infinity and writes null for them, so the
+  //same content is null here too, whichever way it's sent.
+  if(!std::isfinite(val)) {
+    out += (char)(SIMPLE << 5 | 22);
+    return;
+  }
+  //Whole numbers that a double holds exactly go out as integers.
+  //Not -0 though, which would come back as 0.
+  if(std::fabs(val) < 9007199254740992.0 && val == (double)(int64_t)val && !(val == 0 && std::signbit(val))) {
+    if(val >= 0) write_head(UNSIGNED, (uint64_t)val, out);
+    else write_head(NEGATIVE, (uint64_t)(-1 - (int64_t)val), out);
+    return;
+  }
+  if(fits_float(val) && (double)(float)val == val) {
+    float single = val;
+    uint32_t bits;
+    memcpy(&bits, &single, sizeof(bits));
+    out += (char)(SIMPLE << 5 | 26);
+    write_big_endian(bits, 4, out);
+  } else {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    out += (char)(SIMPLE << 5 | 27);
+    write_big_endian(bits, 8, out);
+  }
+}
+
+void write_text(std::string_view text, std::string& out) {
+  write_head(TEXT, text.size(), out);
+  out.append(text.data(), text.size());
+}
+
+void write_numbers(const std::vector<double>& numbers, bool single, std::string& out) {
+  //Typed arrays can't hold the nulls JSON text has for values that
+  //aren't finite. Floats can't hold the biggest doubles either, text
+  //writes those as doubles. Arrays with any of them go out plain.
+  for(double val: numbers) {
+    if(single ? fits_float(val) : std::isfinite(val)) continue;
+    write_head(ARRAY, numbers.size(), out);
+    for(double item: numbers) write_number(single && fits_float(item) ? (float)item : item, out);
+    return;
+  }
+  write_head(TAG, single ? TAG_FLOAT32_LE : TAG_FLOAT64_LE, out);
+  size_t width = single ? 4 : 8;
+  write_head(BYTES, numbers.size() * width, out);
+  size_t start = out.size();
+  out.resize(start + numbers.size() * width);
+  char* dest = &out[start];
+  for(double val: numbers) {
+    uint64_t bits;
+    if(single) {
+      float f = val;
+      uint32_t fbits;
+      memcpy(&fbits, &f, sizeof(fbits));
+      bits = fbits;
+    } else {
+      memcpy(&bits, &val, sizeof(bits));
+    }
+    for(size_t i = 0; i < width; i++) {
+      *dest++ = bits & 0xFF;
+      bits >>= 8;
+    }
+  }
+}
+
+void write_value(const json& val, std::string& out) {
+  if(val.is_null()) {
+    out += (char)(SIMPLE << 5 | 22);
+  } else if(val.is_bool()) {
+    out += (char)(SIMPLE << 5 | (val.get_bool() ? 21 : 20));
+  } else if(val.is_number()) {
+    write_number(val.get_number(), out);
+  } else if(val.is_string()) {
+    write_text(val.get_string_view(), out);
+  } else if(val.is_array()) {
+    auto& values = val.array_data_const();
+    write_head(ARRAY, values.size(), out);
+    for(auto& item: values) write_value(item, out);
+  } else if(val.is_object()) {
+    auto& pairs = val.object_data_const();
+    write_head(MAP, pairs.size(), out);
+    for(auto& pair: pairs) {
+      write_text(pair.first, out);
+      write_value(pair.second, out);
+    }
+  } else if(val.is_numbers()) {
+    write_numbers(val.numbers_data_const(), val.numbers_single(), out);
+  } else {
+    throw std::runtime_error("Unknown object type");
+  }
+}
+
+//Works like the JSON parser: failing records the first error, and after
+//that everything reads as if the data had run out.
+struct reader {
+  std::string_view data;
+  size_t idx = 0;
+  json_parse_error error;
+  //Arrays, maps and tags we're inside of, see json::MAX_DEPTH.
+  int depth = 0;
+
+  void fail(const char* what) {
+    if(!error) error = {what, idx};
+    idx = data.size();
+  }
+  uint8_t byte() {
+    if(idx >= data.size()) {
+      fail("Unexpected end of CBOR");
+      return 0;
+    }
+    return data[idx++];
+  }
+  uint64_t big_endian(int bytes) {
+    if(data.size() - idx < (size_t)bytes) {
+      fail("Unexpected end of CBOR");
+      return 0;
+    }
+    uint64_t ret = 0;
+    for(int i = 0; i < bytes; i++) ret = ret << 8 | (uint8_t)data[idx++];
+    return ret;
+  }
+  //Reads the argument that goes with the initial byte's low 5 bits.
+  uint64_t argument(int info) {
+    if(info < 24) return info;
+    if(info == 24) return big_endian(1);
+    if(info == 25) return big_endian(2);
+    if(info == 26) return big_endian(4);
+    if(info == 27) return big_endian(8);
+    fail("Indefinite lengths aren't supported");
+    return 0;
+  }
+  std::string_view take(uint64_t len) {
+    if(data.size() - idx < len) {
+      fail("Unexpected end of CBOR");
+      return std::string_view();
+    }
+    auto ret = data.substr(idx, len);
+    idx += len;
+    return ret;
+  }
+  json value();
+  //Arrays, maps and tags other than typed arrays, which read the
+  //values in them by recursing.
+  json nested(int major, uint64_t arg);
+  json simple(int info);
+  json typed_array(uint64_t tag);
+};
+
+double half_to_double(uint16_t half) {
+  int exponent = (half >> 10) & 0x1F;
+  int fraction = half & 0x3FF;
+  double val;
+  if(exponent == 0) val = std::ldexp(fraction, -24);
+  else if(exponent == 31) val = fraction ? NAN : INFINITY;
+  else val = std::ldexp(fraction + 1024, exponent - 25);
+  return (half & 0x8000) ? -val : val;
+}
+
+json reader::simple(int info) {
+  switch(info) {
+    case 20: return json(false);
+    case 21: return json(true);
+    //Undefined is as close to null as JSON gets.
+    case 22: case 23: return json();
+    case 25: return json(half_to_double(big_endian(2)));
+    case 26: {
+      uint32_t bits = big_endian(4);
+      float val;
+      memcpy(&val, &bits, sizeof(val));
+      return json((double)val);
+    }
+    case 27: {
+      uint64_t bits = big_endian(8);
+      double val;
+      memcpy(&val, &bits, sizeof(val));
+      return json(val);
+    }
+  }
+  fail("Unsupported simple value");
+  return json();
+}
+
+json reader::typed_array(uint64_t tag) {
+  uint8_t initial = byte();
+  if(initial >> 5 != BYTES) {
+    fail("Typed array isn't a byte string");
+    return json();
+  }
+  auto bytes = take(argument(initial & 0x1F));
+  size_t width = tag == TAG_FLOAT32_LE ? 4 : 8;
+  if(bytes.size() % width) {
+    fail("Typed array has a partial element");
+    return json();
+  }
+  //They come back as a plain array, the same as the JSON text for them
+  //would, so handlers can index them whichever way they were sent.
+  json ret = json::array({});
+  auto& values = ret.array_data();
+  values.reserve(bytes.size() / width);
+  for(size_t i = 0; i < bytes.size(); i += width) {
+    uint64_t bits = 0;
+    for(size_t b = width; b > 0; b--) bits = bits << 8 | (uint8_t)bytes[i + b - 1];
+    if(width == 4) {
+      uint32_t fbits = bits;
+      float val;
+      memcpy(&val, &fbits, sizeof(val));
+      values.emplace_back((double)val);
+    } else {
+      double val;
+      memcpy(&val, &bits, sizeof(val));
+      values.emplace_back(val);
+    }
+  }
+  return ret;
+}
+
+json reader::value() {
+  uint8_t initial = byte();
+  int major = initial >> 5;
+  int info = initial & 0x1F;
+  if(major == SIMPLE) return simple(info);
+  uint64_t arg = argument(info);
+  switch(major) {
+    case UNSIGNED: return json((double)arg);
+    case NEGATIVE: return json(-1 - (double)arg);
+    //JSON has no bytes, strings are the closest thing.
+    case BYTES: case TEXT: return json(std::string(take(arg)));
+    case TAG:
+      if(arg == TAG_FLOAT32_LE || arg == TAG_FLOAT64_LE) return typed_array(arg);
+      //Falls through, other tags wrap a value, and they can be chained
+      //with nothing else in between, so they count as a level too.
+    case ARRAY: case MAP: {
+      if(depth == json::MAX_DEPTH) {
+        fail("Nested too deep");
+        return json();
+      }
+      depth++;
+      json ret = nested(major, arg);
+      depth--;
+      return ret;
+    }
+  }
+  fail("Unknown major type");
+  return json();
+}
+
+json reader::nested(int major, uint64_t arg) {
+  switch(major) {
+    case ARRAY: {
+      json ret = json::array({});
+      auto& values = ret.array_data();
+      //Every item takes at least a byte, which keeps bad lengths in check.
+      if(arg > data.size() - idx) {
+        fail("Array is longer than the data");
+        return json();
+      }
+      //Items are far bigger than a byte though, and nested ones would
+      //each reserve against the same data, so past a few it grows as
+      //items are actually read.
+      values.reserve(std::min<uint64_t>(arg, MAX_RESERVE));
+      for(uint64_t i = 0; i < arg && !error; i++) values.push_back(value());
+      return ret;
+    }
+    case MAP: {
+      json ret = json::object({});
+      auto& pairs = ret.object_data();
+      if(arg > data.size() - idx) {
+        fail("Map is longer than the data");
+        return json();
+      }
+      pairs.reserve(std::min<uint64_t>(arg, MAX_RESERVE));
+      for(uint64_t i = 0; i < arg && !error; i++) {
+        uint8_t keyInitial = byte();
+        if(keyInitial >> 5 != TEXT) {
+          fail("Map keys must be strings");
+          break;
+        }
+        auto key = json_key::from_input(take(argument(keyInitial & 0x1F)));
+        pairs.emplace_back(std::move(key), value());
+      }
+      return ret;
+    }
+    case TAG:
+      //They don't change what the value is in JSON terms.
+      return value();
+  }
+  return json();
+}
+
+}
+
+void json::write_cbor(std::string& out) const {
+  write_value(*this, out);
+}
+
+json json::parse_cbor(std::string_view data) {
+  json_parse_error error;
+  json ret = try_parse_cbor(data, error);
+  if(error) throw std::runtime_error(error.what + std::string(" at byte ") + std::to_string(error.offset));
+  return ret;
+}
+
+json json::try_parse_cbor(std::string_view data, json_parse_error& error) {
+  reader r{data};
+  json ret = r.value();
+  if(!r.error && r.idx != data.size()) r.fail("Extra data after CBOR value");
+  error = r.error;
+  if(error) ret.set_null();
+  return ret;
+}
@@ -0,0 +1,383 @@
+#include "json_corpus.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <malloc.h>
+#include <sstream>
+
+#ifdef JSON_BENCH
+
+// ----- Heap use -----
+
+#ifdef JSON_COUNT_ALLOCS
+#include <atomic>
+#include <new>
+
+static std::atomic<long> allocCount{0};
+
+void* operator new(size_t size) {
+  allocCount.fetch_add(1, std::memory_order_relaxed);
+  void* ret = malloc(size ? size : 1);
+  if(!ret) throw std::bad_alloc();
+  return ret;
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+static long alloc_count() { return allocCount.load(std::memory_order_relaxed); }
+#else
+static long alloc_count() { return -1; }
+#endif
+
+static long heap_in_use() {
+  //Big blocks can be mapped separately, those are in hblkhd.
+  auto info = mallinfo();
+  return (long)info.uordblks + info.hblkhd;
+}
+
+//Follows heap use from when it's made. Peaks are only seen when
+//sample() is called, so call it wherever the most is held.
+struct heap_watch {
+  long startAllocs = alloc_count();
+  long start = heap_in_use();
+  long peak = 0;
+  void sample() {
+    long now = heap_in_use() - start;
+    if(now > peak) peak = now;
+  }
+  json_heap_use finish() {
+    sample();
+    json_heap_use ret;
+    if(startAllocs >= 0) ret.allocs = alloc_count() - startAllocs;
+    ret.bytes = heap_in_use() - start;
+    ret.peak = peak;
+    return ret;
+  }
+};
+
+// ----- Corpora -----
+
+//Not random enough for anything but making test data, but the same
+//everywhere, so host and robot runs see the same documents.
+struct corpus_random {
+  uint32_t state;
+  explicit corpus_random(uint32_t seed): state(seed ? seed : 1) {}
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+  uint32_t below(uint32_t max) { return next() % max; }
+};
+
+static json help_label(const std::string& text) {
+  return json::object({{"kind", "label"}, {"text", text}});
+}
+
+static json help_input(const char* kind, const std::string& key) {
+  return json::object({{"kind", kind}, {"key", key}, {"label", key}});
+}
+
+//Shaped like what the tabu_help calls around the tree register.
+static std::string help_registry(int topics) {
+  static const char* words[] = {"pid", "follower", "max", "test", "turn", "drive", "lift", "intake", "blackbox", "bench"};
+  static const char* inputs[] = {"number", "bool", "string"};
+  corpus_random rng(15);
+  json registry = json::object({});
+  for(int i = 0; i < topics; i++) {
+    std::string topic = std::string(words[i % 10]) + "." + words[(i / 10 + 3) % 10] + "_" + std::to_string(i);
+    json entries = json::array({help_label("Does the " + topic + " thing, \"quoted\" and all.\tTabbed.")});
+    int count = 1 + rng.below(9);
+    for(int k = 0; k < count; k++) {
+      entries.array_data().push_back(help_input(inputs[rng.below(3)], std::string(words[rng.below(10)]) + std::to_string(k)));
+    }
+    entries.array_data().push_back(json::object({{"kind", "reply_action"}, {"do", "graph(it.graphable); say('done: ' + it.finalVel)"}}));
+    registry[topic] = entries;
+  }
+  return registry.to_string();
+}
+
+//A simple_follower.test reply, once as rows and once as columns.
+static std::vector<std::string> graph_replies(int samples) {
+  json_table table({"time", "disp", "cVel", "mVel", "dVel"});
+  table.reserve(samples);
+  for(int i = 0; i < samples; i++) {
+    double t = i / 100.0;
+    double vel = 24 * std::sin(t) + 3.7;
+    table.add_row({t, 24 * (1 - std::cos(t)) + t * 3.7, vel, vel * 0.97 + std::sin(t * 31) * 0.4, vel * 1.02 + 0.1});
+  }
+  std::vector<std::string> ret;
+  ret.push_back(json::object({{"graphable", table.to_rows()}, {"finalVel", 0.25}}).to_string());
+  ret.push_back(json::object({{"graphable", table.to_columns()}, {"finalVel", 0.25}}).to_string());
+  return ret;
+}
+
+static std::vector<std::string> move_contents(int count) {
+  std::vector<std::string> ret;
+  ret.reserve(count);
+  for(int i = 0; i < count; i++) {
+    std::string doc = "{\"axis\":" + std::to_string(i % 4) + ",\"value\":";
+    json::write_number(std::sin(i / 50.0), doc);
+    doc += '}';
+    ret.push_back(std::move(doc));
+  }
+  return ret;
+}
+
+static std::vector<std::string> nested_payloads(int depth) {
+  std::vector<std::string> ret;
+  std::string arrays(depth, '[');
+  arrays += "1";
+  arrays.append(depth, ']');
+  ret.push_back(std::move(arrays));
+  std::string objects;
+  for(int i = 0; i < depth; i++) objects += "{\"k" + std::to_string(i) + "\":";
+  objects += "\"\\u00e9\\ud83d\\ude00 end\"";
+  objects.append(depth, '}');
+  ret.push_back(std::move(objects));
+  //Both at once, with some width at every level. Each step is two
+  //levels, so this is no deeper than the others.
+  std::string mixed;
+  int steps = (depth - 1) / 2;
+  for(int i = 0; i < steps; i++) mixed += "{\"n\":" + std::to_string(i) + ",\"s\":\"line\\n\",\"list\":[true,null,-1.5e3,";
+  mixed += "{}";
+  for(int i = 0; i < steps; i++) mixed += "]}";
+  ret.push_back(std::move(mixed));
+  return ret;
+}
+
+std::vector<std::string> json_corpus(json_corpus_kind kind, int size) {
+  switch(kind) {
+    case HELP_CORPUS: return {help_registry(size)};
+    case GRAPH_CORPUS: return graph_replies(size);
+    case MOVES_CORPUS: return move_contents(size);
+    case NESTED_CORPUS: return nested_payloads(size);
+  }
+  return {};
+}
+
+const char* json_corpus_name(int kind) {
+  static const char* names[] = {"help", "graph", "moves", "nested"};
+  return kind >= 0 && kind < 4 ? names[kind] : nullptr;
+}
+
+// ----- Benchmark -----
+
+double json_bench_result::parse_rate() const {
+  return parseUs > 0 ? bytes / parseUs : 0;
+}
+
+double json_bench_result::write_rate() const {
+  return writeUs > 0 ? bytes / writeUs : 0;
+}
+
+json_bench_result json_bench(const std::vector<std::string>& docs, int passes, uint64_t (*micros)()) {
+  json_bench_result ret;
+  ret.docs = docs.size();
+  for(auto& doc: docs) ret.bytes += doc.size();
+  std::vector<json> parsed;
+  parsed.reserve(docs.size());
+  //Heap use is taken from the first pass, they're all the same.
+  uint64_t parseTime = 0;
+  for(int pass = 0; pass < passes; pass++) {
+    parsed.clear();
+    heap_watch watch;
+    auto begin = micros();
+    for(auto& doc: docs) parsed.push_back(json::parse(doc));
+    parseTime += micros() - begin;
+    if(pass == 0) ret.parseHeap = watch.finish();
+  }
+  std::string out;
+  uint64_t writeTime = 0;
+  for(int pass = 0; pass < passes; pass++) {
+    heap_watch watch;
+    auto begin = micros();
+    for(auto& doc: parsed) {
+      out.clear();
+      doc.write(out);
+    }
+    writeTime += micros() - begin;
+    if(pass == 0) ret.writeHeap = watch.finish();
+  }
+  ret.bytes *= passes;
+  ret.parseUs = parseTime;
+  ret.writeUs = writeTime;
+  return ret;
+}
+
+//Fake samples, shaped like a simple_follower.test graphable
+//(time, disp, cVel, mVel, dVel) at 100Hz.
+static std::vector<std::vector<double>> follower_columns(int count) {
+  std::vector<std::vector<double>> cols(5);
+  for(auto& col: cols) col.reserve(count);
+  for(int i = 0; i < count; i++) {
+    double t = i / 100.0;
+    double disp = 24 * (1 - std::cos(t)) + t * 3.7;
+    double vel = 24 * std::sin(t) + 3.7;
+    cols[0].push_back(t);
+    cols[1].push_back(disp);
+    cols[2].push_back(vel);
+    cols[3].push_back(vel * 0.97 + std::sin(t * 31) * 0.4);
+    cols[4].push_back(vel * 1.02 + 0.1);
+  }
+  return cols;
+}
+
+json_numbers_result json_bench_numbers(int samples, uint64_t (*micros)()) {
+  json_numbers_result ret;
+  auto cols = follower_columns(samples);
+  ret.values = samples * cols.size();
+  std::string out;
+  out.reserve(ret.values * 20);
+  auto begin = micros();
+  for(auto& col: cols) {
+    for(double val: col) {
+      std::ostringstream str;
+      str << val;
+      out += str.str();
+      out += ',';
+    }
+  }
+  ret.ostreamUs = micros() - begin;
+  ret.ostreamBytes = out.size();
+  const char* pos = out.c_str();
+  for(auto& col: cols) {
+    for(double val: col) {
+      char* end;
+      if(strtod(pos, &end) != val) ret.ostreamLossy++;
+      pos = end + 1;
+    }
+  }
+  out.clear();
+  begin = micros();
+  for(auto& col: cols) {
+    for(double val: col) {
+      json::write_number(val, out);
+      out += ',';
+    }
+  }
+  ret.writerUs = micros() - begin;
+  ret.writerBytes = out.size();
+  return ret;
+}
+
+// ----- Fuzzing -----
+
+//Bytes that are likely to change what the parser does.
+static const char fuzzBytes[] = "[]{}\",:0123456789-+.eE \t\ntrufalsn\\/bfnrtu\"\x80\xc3\xa9\xff";
+
+static void mutate(std::string& text, corpus_random& rng) {
+  int edits = 1 + rng.below(4);
+  for(int i = 0; i < edits; i++) {
+    size_t pos = text.empty() ? 0 : rng.below(text.size());
+    switch(rng.below(6)) {
+      case 0:
+        if(!text.empty()) text[pos] ^= 1 << rng.below(8);
+        break;
+      case 1:
+        text.insert(text.begin() + pos, fuzzBytes[rng.below(sizeof(fuzzBytes) - 1)]);
+        break;
+      case 2:
+        if(!text.empty()) text.erase(pos, 1 + rng.below(8));
+        break;
+      case 3:
+        if(!text.empty()) text[pos] = fuzzBytes[rng.below(sizeof(fuzzBytes) - 1)];
+        break;
+      case 4: {
+        //Repeats a piece, which makes deeper nesting and longer strings.
+        size_t len = 1 + rng.below(16);
+        text.insert(pos, text.substr(pos, len));
+        break;
+      }
+      case 5:
+        text.resize(pos);
+        break;
+    }
+  }
+}
+
+//Fails when the events don't pair up or the stream would be bad JSON.
+struct fuzz_handler: public json_handler {
+  int depth = 0;
+  bool broken = false;
+  bool begin_object() override { depth++; return true; }
+  bool end_object() override { if(--depth < 0) broken = true; return true; }
+  bool begin_array() override { depth++; return true; }
+  bool end_array() override { if(--depth < 0) broken = true; return true; }
+};
+
+//What's wrong with text, or null if everything agreed.
+static const char* check(std::string_view text, corpus_random& rng, bool& valid) {
+  json_parse_error error;
+  json parsed = json::try_parse(text, error);
+  valid = !error;
+  fuzz_handler handler;
+  json_parse_error eventError;
+  bool eventsOk = json::try_parse_events(text, handler, eventError);
+  if(eventsOk == (bool)error) return "parse_events disagrees with parse";
+  if(eventsOk && (handler.depth != 0 || handler.broken)) return "Unbalanced events";
+  if(error) return nullptr;
+  std::string written = parsed.to_string();
+  json_parse_error again;
+  json reparsed = json::try_parse(written, again);
+  if(again) return "Written text doesn't parse";
+  if(reparsed.to_string() != written) return "Write isn't stable";
+  std::string cbor;
+  parsed.write_cbor(cbor);
+  json_parse_error cborError;
+  json fromCbor = json::try_parse_cbor(cbor, cborError);
+  if(cborError) return "CBOR doesn't parse";
+  if(fromCbor.to_string() != written) return "CBOR round trip changed it";
+  //The same text fed to a stream in random pieces.
+  try {
+    json_stream stream;
+    size_t pos = 0;
+    while(pos < text.size()) {
+      size_t len = 1 + rng.below(64);
+      stream.feed(text.substr(pos, len));
+      pos += len;
+    }
+    if(stream.finish().to_string() != written) return "json_stream disagrees with parse";
+  } catch(const std::runtime_error&) {
+    return "json_stream rejected valid text";
+  }
+  //Mangled CBOR only has to not crash.
+  mutate(cbor, rng);
+  json::try_parse_cbor(cbor, cborError);
+  return nullptr;
+}
+
+std::vector<std::string> json_fuzz_seeds() {
+  std::vector<std::string> seeds;
+  for(int kind = 0; json_corpus_name(kind); kind++) {
+    //Small ones, mutants of big documents are mostly the same document.
+    auto docs = json_corpus((json_corpus_kind)kind, kind == GRAPH_CORPUS ? 20 : 4);
+    seeds.insert(seeds.end(), docs.begin(), docs.end());
+  }
+  for(int depth: {json::MAX_DEPTH, json::MAX_DEPTH + 1}) {
+    auto docs = nested_payloads(depth);
+    seeds.insert(seeds.end(), docs.begin(), docs.end());
+  }
+  return seeds;
+}
+
+json_fuzz_result json_fuzz(const std::vector<std::string>& seeds, int runs, uint32_t seed) {
+  json_fuzz_result ret;
+  if(seeds.empty()) return ret;
+  corpus_random rng(seed);
+  for(int i = 0; i < runs; i++) {
+    std::string text = seeds[rng.below(seeds.size())];
+    mutate(text, rng);
+    ret.runs++;
+    bool valid;
+    const char* failure = check(text, rng, valid);
+    if(valid) ret.valid++;
+    if(failure && !ret.failures++) {
+      ret.failedInput = text;
+      ret.failure = failure;
+    }
+  }
+  return ret;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#pragma once
+//Realistic JSON to benchmark and fuzz json.cpp with. Nothing here needs
+//the robot, so it builds on a host as it is, next to json*.cpp, to try
+//parser changes out before they go on the brain. "make json-bench" runs
+//it there (host/json_host.cpp). The json_bench tabu topics (jsonbench.cpp)
+//run the same code on the robot, in builds made with JSON_BENCH. Other
+//robot builds leave json_corpus.cpp out, it's all inside JSON_BENCH.
+
+#include "json.hpp"
+
+enum json_corpus_kind {
+  HELP_CORPUS,   //A tabu_help registry, lots of small objects and strings
+  GRAPH_CORPUS,  //Graph replies of size samples, as rows and as columns
+  MOVES_CORPUS,  //size blue_control.move contents, like a controller storm
+  NESTED_CORPUS  //Payloads nested size deep, arrays and objects. Past
+                 //json::MAX_DEPTH they're meant to fail to parse.
+};
+//Documents, one JSON text each.
+std::vector<std::string> json_corpus(json_corpus_kind kind, int size);
+//Name of kind, or null past the last one, for looping over them all.
+const char* json_corpus_name(int kind);
+
+//Heap use around a stretch of code. Bytes come from mallinfo, so they
+//count everything. Allocations are only counted when built with
+//JSON_COUNT_ALLOCS, which swaps in a counting operator new. The robot
+//build leaves that out since the kernel has its own.
+struct json_heap_use {
+  //Allocations made, or -1 when they aren't counted.
+  long allocs = -1;
+  //In use at the end, over what was in use at the start.
+  long bytes = 0;
+  //Most that was in use at once, over the start.
+  long peak = 0;
+};
+
+struct json_bench_result {
+  size_t docs = 0;
+  size_t bytes = 0;
+  double parseUs = 0;
+  double writeUs = 0;
+  //Parsing every doc and holding on to them all.
+  json_heap_use parseHeap;
+  //Writing them all back out into one reused buffer.
+  json_heap_use writeHeap;
+  //Throughput in MB/s.
+  double parse_rate() const;
+  double write_rate() const;
+};
+//Times passes over every doc. micros is whatever clock the caller has.
+json_bench_result json_bench(const std::vector<std::string>& docs, int passes, uint64_t (*micros)());
+
+struct json_numbers_result {
+  size_t values = 0;
+  //What json::to_string used to do, an ostringstream per number.
+  double ostreamUs = 0;
+  size_t ostreamBytes = 0;
+  //Values that didn't read back the same.
+  int ostreamLossy = 0;
+  //json::write_number.
+  double writerUs = 0;
+  size_t writerBytes = 0;
+};
+//Times number formatting over samples rows of follower-shaped numbers.
+json_numbers_result json_bench_numbers(int samples, uint64_t (*micros)());
+
+struct json_fuzz_result {
+  int runs = 0;
+  //Mutants that still parsed.
+  int valid = 0;
+  int failures = 0;
+  //The first input that went wrong, and how.
+  std::string failedInput;
+  const char* failure = nullptr;
+};
+//Mutates seeds and checks that every way in to the parser agrees:
+//parse vs parse_events vs json_stream, and that valid text survives
+//write and CBOR round trips unchanged. A crash is a failure too, of
+//course, just a louder one.
+json_fuzz_result json_fuzz(const std::vector<std::string>& seeds, int runs, uint32_t seed);
+//Small documents of every kind to fuzz from, with nesting right at
+//json::MAX_DEPTH and just past it.
+std::vector<std::string> json_fuzz_seeds();
@@ -0,0 +1,489 @@
+//Number formatting for the JSON writer.
+//Doubles are printed with the shortest digits that still read back as the
+//exact same double, using Grisu3 (Florian Loitsch, "Printing Floating-Point
+//Numbers Quickly and Accurately with Integers"). Floats go through the same
+//code, with their own neighbours. Grisu3 knows when it can't be sure its
+//digits are the shortest, and those few go the slow way, with exact
+//digit generation on fixed size bignums. None of it touches the locale
+//or the heap, and whole numbers skip all of it.
+
+#include "json.hpp"
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+namespace {
+
+//A floating point number f * 2^e, with a full 64 bit significand.
+struct diyfp {
+  uint64_t f;
+  int e;
+};
+
+diyfp sub(diyfp x, diyfp y) {
+  return {x.f - y.f, x.e};
+}
+
+//Product of two diyfps, rounded to the upper 64 bits.
+diyfp mul(diyfp x, diyfp y) {
+  uint64_t u_lo = x.f & 0xFFFFFFFFu, u_hi = x.f >> 32;
+  uint64_t v_lo = y.f & 0xFFFFFFFFu, v_hi = y.f >> 32;
+  uint64_t p0 = u_lo * v_lo, p1 = u_lo * v_hi;
+  uint64_t p2 = u_hi * v_lo, p3 = u_hi * v_hi;
+  uint64_t q = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+  q += uint64_t(1) << 31;
+  return {p3 + (p2 >> 32) + (p1 >> 32) + (q >> 32), x.e + y.e + 64};
+}
+
+diyfp normalize(diyfp x) {
+  while((x.f >> 63) == 0) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+//The value with these bits as f * 2^e, f not normalized. The bits are
+//split up by the caller, so doubles and floats can share this.
+diyfp unpack(uint64_t fraction, int exponent, int fractionBits, int bias) {
+  const uint64_t hidden = uint64_t(1) << fractionBits;
+  return exponent == 0 ? diyfp{fraction, 1 - bias} : diyfp{fraction + hidden, exponent - bias};
+}
+
+//The lower neighbour is closer when the significand is a power of two.
+bool lower_closer(uint64_t fraction, int exponent) {
+  return fraction == 0 && exponent > 1;
+}
+
+//Gets the value v, and the two halfway points to its neighbouring values.
+//m_minus and m_plus share the exponent of the normalized m_plus.
+void boundaries(uint64_t fraction, int exponent, int fractionBits, int bias, diyfp& m_minus, diyfp& v, diyfp& m_plus) {
+  v = unpack(fraction, exponent, fractionBits, bias);
+  m_plus = normalize({2 * v.f + 1, v.e - 1});
+  diyfp lower = lower_closer(fraction, exponent) ? diyfp{4 * v.f - 1, v.e - 2} : diyfp{2 * v.f - 1, v.e - 1};
+  m_minus = {lower.f << (lower.e - m_plus.e), m_plus.e};
+  v = normalize(v);
+}
+
+struct cached_power {
+  uint64_t f;
+  int e;
+  int k;
+};
+
+//Normalized 10^k for k = -300, -292, ..., 324.
+const cached_power powers[] = {
+  {0xAB70FE17C79AC6CA, -1060, -300},
+  {0xFF77B1FCBEBCDC4F, -1034, -292},
+  {0xBE5691EF416BD60C, -1007, -284},
+  {0x8DD01FAD907FFC3C,  -980, -276},
+  {0xD3515C2831559A83,  -954, -268},
+  {0x9D71AC8FADA6C9B5,  -927, -260},
+  {0xEA9C227723EE8BCB,  -901, -252},
+  {0xAECC49914078536D,  -874, -244},
+  {0x823C12795DB6CE57,  -847, -236},
+  {0xC21094364DFB5637,  -821, -228},
+  {0x9096EA6F3848984F,  -794, -220},
+  {0xD77485CB25823AC7,  -768, -212},
+  {0xA086CFCD97BF97F4,  -741, -204},
+  {0xEF340A98172AACE5,  -715, -196},
+  {0xB23867FB2A35B28E,  -688, -188},
+  {0x84C8D4DFD2C63F3B,  -661, -180},
+  {0xC5DD44271AD3CDBA,  -635, -172},
+  {0x936B9FCEBB25C996,  -608, -164},
+  {0xDBAC6C247D62A584,  -582, -156},
+  {0xA3AB66580D5FDAF6,  -555, -148},
+  {0xF3E2F893DEC3F126,  -529, -140},
+  {0xB5B5ADA8AAFF80B8,  -502, -132},
+  {0x87625F056C7C4A8B,  -475, -124},
+  {0xC9BCFF6034C13053,  -449, -116},
+  {0x964E858C91BA2655,  -422, -108},
+  {0xDFF9772470297EBD,  -396, -100},
+  {0xA6DFBD9FB8E5B88F,  -369,  -92},
+  {0xF8A95FCF88747D94,  -343,  -84},
+  {0xB94470938FA89BCF,  -316,  -76},
+  {0x8A08F0F8BF0F156B,  -289,  -68},
+  {0xCDB02555653131B6,  -263,  -60},
+  {0x993FE2C6D07B7FAC,  -236,  -52},
+  {0xE45C10C42A2B3B06,  -210,  -44},
+  {0xAA242499697392D3,  -183,  -36},
+  {0xFD87B5F28300CA0E,  -157,  -28},
+  {0xBCE5086492111AEB,  -130,  -20},
+  {0x8CBCCC096F5088CC,  -103,  -12},
+  {0xD1B71758E219652C,   -77,   -4},
+  {0x9C40000000000000,   -50,    4},
+  {0xE8D4A51000000000,   -24,   12},
+  {0xAD78EBC5AC620000,     3,   20},
+  {0x813F3978F8940984,    30,   28},
+  {0xC097CE7BC90715B3,    56,   36},
+  {0x8F7E32CE7BEA5C70,    83,   44},
+  {0xD5D238A4ABE98068,   109,   52},
+  {0x9F4F2726179A2245,   136,   60},
+  {0xED63A231D4C4FB27,   162,   68},
+  {0xB0DE65388CC8ADA8,   189,   76},
+  {0x83C7088E1AAB65DB,   216,   84},
+  {0xC45D1DF942711D9A,   242,   92},
+  {0x924D692CA61BE758,   269,  100},
+  {0xDA01EE641A708DEA,   295,  108},
+  {0xA26DA3999AEF774A,   322,  116},
+  {0xF209787BB47D6B85,   348,  124},
+  {0xB454E4A179DD1877,   375,  132},
+  {0x865B86925B9BC5C2,   402,  140},
+  {0xC83553C5C8965D3D,   428,  148},
+  {0x952AB45CFA97A0B3,   455,  156},
+  {0xDE469FBD99A05FE3,   481,  164},
+  {0xA59BC234DB398C25,   508,  172},
+  {0xF6C69A72A3989F5C,   534,  180},
+  {0xB7DCBF5354E9BECE,   561,  188},
+  {0x88FCF317F22241E2,   588,  196},
+  {0xCC20CE9BD35C78A5,   614,  204},
+  {0x98165AF37B2153DF,   641,  212},
+  {0xE2A0B5DC971F303A,   667,  220},
+  {0xA8D9D1535CE3B396,   694,  228},
+  {0xFB9B7CD9A4A7443C,   720,  236},
+  {0xBB764C4CA7A44410,   747,  244},
+  {0x8BAB8EEFB6409C1A,   774,  252},
+  {0xD01FEF10A657842C,   800,  260},
+  {0x9B10A4E5E9913129,   827,  268},
+  {0xE7109BFBA19C0C9D,   853,  276},
+  {0xAC2820D9623BF429,   880,  284},
+  {0x80444B5E7AA7CF85,   907,  292},
+  {0xBF21E44003ACDD2D,   933,  300},
+  {0x8E679C2F5E44FF8F,   960,  308},
+  {0xD433179D9C8CB841,   986,  316},
+  {0x9E19DB92B4E31BA9,  1013,  324},
+};
+
+//Target range for the binary exponent of the scaled value.
+const int alpha = -60;
+
+//Picks a power of ten c so that v * c has an exponent in [-60, -32].
+cached_power power_for_exponent(int e) {
+  int f = alpha - e - 1;
+  int k = (f * 78913) / (1 << 18) + (f > 0);
+  int index = (300 + k + 7) / 8;
+  return powers[index];
+}
+
+//Steps the last digit down while that brings it closer to w, then says
+//whether the digits are sure to be the closest and shortest. All the
+//distances are off by up to unit, from the rounding in mul, so it's only
+//sure when that can't change the answer.
+bool round_weed(char* buf, int len, uint64_t distTooHigh, uint64_t unsafe, uint64_t rest, uint64_t ten_k, uint64_t unit) {
+  uint64_t smallDist = distTooHigh - unit;
+  uint64_t bigDist = distTooHigh + unit;
+  while(rest < smallDist && unsafe - rest >= ten_k && (rest + ten_k < smallDist || smallDist - rest >= rest + ten_k - smallDist)) {
+    buf[len - 1]--;
+    rest += ten_k;
+  }
+  //If it would have gone down again from the far side of w, which
+  //digit is closest isn't known.
+  if(rest < bigDist && unsafe - rest >= ten_k && (rest + ten_k < bigDist || bigDist - rest > rest + ten_k - bigDist)) {
+    return false;
+  }
+  return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+//Grisu3: writes the digits of w, as few as will keep it between m_minus
+//and m_plus. False when rounding in the scaling leaves it unsure that
+//they're the shortest, which is about 0.5% of doubles.
+bool digit_gen(char* buf, int& len, int& dec_exp, diyfp m_minus, diyfp w, diyfp m_plus) {
+  uint64_t unit = 1;
+  diyfp tooLow = {m_minus.f - unit, m_minus.e};
+  diyfp tooHigh = {m_plus.f + unit, m_plus.e};
+  uint64_t unsafe = sub(tooHigh, tooLow).f;
+  const int shift = -w.e;
+  const uint64_t one = uint64_t(1) << shift;
+  uint32_t p1 = tooHigh.f >> shift;
+  uint64_t p2 = tooHigh.f & (one - 1);
+
+  uint32_t pow10 = 1;
+  int n = 1;
+  while(n < 10 && p1 >= pow10 * 10) {
+    pow10 *= 10;
+    n++;
+  }
+  //Integral digits
+  while(n > 0) {
+    buf[len++] = '0' + p1 / pow10;
+    p1 %= pow10;
+    n--;
+    uint64_t rest = (uint64_t(p1) << shift) + p2;
+    if(rest < unsafe) {
+      dec_exp += n;
+      return round_weed(buf, len, sub(tooHigh, w).f, unsafe, rest, uint64_t(pow10) << shift, unit);
+    }
+    pow10 /= 10;
+  }
+  //Fractional digits
+  while(true) {
+    p2 *= 10;
+    unit *= 10;
+    unsafe *= 10;
+    buf[len++] = '0' + (p2 >> shift);
+    p2 &= one - 1;
+    dec_exp--;
+    if(p2 < unsafe) return round_weed(buf, len, sub(tooHigh, w).f * unit, unsafe, p2, one, unit);
+  }
+}
+
+//An unsigned integer for exact_digits, least significant word first.
+//The biggest it needs is a bit over 2^1080 (a double's 2^1075 range, then
+//times ten), so a fixed size does, and it never touches the heap.
+struct bignum {
+  static const int WORDS = 40;
+  uint32_t words[WORDS];
+  int size = 0;
+  explicit bignum(uint64_t val) {
+    while(val) {
+      words[size++] = (uint32_t)val;
+      val >>= 32;
+    }
+  }
+  void mul(uint32_t m) {
+    uint64_t carry = 0;
+    for(int i = 0; i < size; i++) {
+      uint64_t p = (uint64_t)words[i] * m + carry;
+      words[i] = (uint32_t)p;
+      carry = p >> 32;
+    }
+    if(carry) words[size++] = (uint32_t)carry;
+  }
+  void mul_pow10(int k) {
+    for(; k >= 9; k -= 9) mul(1000000000);
+    uint32_t p = 1;
+    while(k--) p *= 10;
+    mul(p);
+  }
+  void shift(int bits) {
+    int whole = bits / 32;
+    bits %= 32;
+    if(bits) {
+      uint32_t carry = 0;
+      for(int i = 0; i < size; i++) {
+        uint32_t w = words[i];
+        words[i] = w << bits | carry;
+        carry = w >> (32 - bits);
+      }
+      if(carry) words[size++] = carry;
+    }
+    if(whole && size) {
+      memmove(words + whole, words, size * sizeof(uint32_t));
+      memset(words, 0, whole * sizeof(uint32_t));
+      size += whole;
+    }
+  }
+  void add(const bignum& other) {
+    uint64_t carry = 0;
+    for(int i = 0; i < size || i < other.size; i++) {
+      uint64_t sum = (i < size ? words[i] : 0) + (uint64_t)(i < other.size ? other.words[i] : 0) + carry;
+      words[i] = (uint32_t)sum;
+      carry = sum >> 32;
+    }
+    if(other.size > size) size = other.size;
+    if(carry) words[size++] = (uint32_t)carry;
+  }
+  //Only for other <= this.
+  void sub(const bignum& other) {
+    int64_t borrow = 0;
+    for(int i = 0; i < size; i++) {
+      int64_t diff = (int64_t)words[i] - (i < other.size ? other.words[i] : 0) - borrow;
+      borrow = diff < 0;
+      words[i] = (uint32_t)(diff + (borrow << 32));
+    }
+    while(size && !words[size - 1]) size--;
+  }
+  int compare(const bignum& other) const {
+    if(size != other.size) return size < other.size ? -1 : 1;
+    for(int i = size - 1; i >= 0; i--) {
+      if(words[i] != other.words[i]) return words[i] < other.words[i] ? -1 : 1;
+    }
+    return 0;
+  }
+};
+
+//For the few values Grisu3 isn't sure of. Steele and White's exact digit
+//generation, the way Burger and Dybvig lay it out: v is r / s, and its
+//halfway points to the neighbouring values are m_minus / s below it and
+//m_plus / s above, all kept as integers so nothing is rounded. Slow, but
+//it doesn't come up often. v is f * 2^e.
+void exact_digits(uint64_t f, int e, bool lowerCloser, char* buf, int& len, int& dec_exp) {
+  //Reading rounds ties to an even significand, so those can have their
+  //halfway points too.
+  bool even = !(f & 1);
+  bignum r(f), s(1), m_plus(1), m_minus(1);
+  r.shift(lowerCloser ? 2 : 1);
+  s.shift(lowerCloser ? 2 : 1);
+  if(lowerCloser) m_plus.shift(1);
+  if(e >= 0) {
+    r.shift(e);
+    m_plus.shift(e);
+    m_minus.shift(e);
+  } else {
+    s.shift(-e);
+  }
+  //About log10(v), never too high. It's put right below, so that v and
+  //its upper halfway point are under 10^k.
+  int bits = 64;
+  while(!(f >> (bits - 1))) bits--;
+  int x = e + bits - 1;
+  int k = (x * 78913) / (1 << 18) + (x > 0);
+  if(k >= 0) {
+    s.mul_pow10(k);
+  } else {
+    r.mul_pow10(-k);
+    m_plus.mul_pow10(-k);
+    m_minus.mul_pow10(-k);
+  }
+  auto past_high = [&]() {
+    bignum high = r;
+    high.add(m_plus);
+    int c = high.compare(s);
+    return even ? c >= 0 : c > 0;
+  };
+  while(past_high()) {
+    s.mul(10);
+    k++;
+  }
+  len = 0;
+  while(true) {
+    r.mul(10);
+    m_plus.mul(10);
+    m_minus.mul(10);
+    int digit = 0;
+    while(r.compare(s) >= 0) {
+      r.sub(s);
+      digit++;
+    }
+    int c = r.compare(m_minus);
+    bool low = even ? c <= 0 : c < 0;
+    bool high = past_high();
+    if(low && high) {
+      //Both ends would do, take the closer.
+      bignum twice = r;
+      twice.shift(1);
+      if(twice.compare(s) >= 0) digit++;
+    } else if(high) {
+      digit++;
+    }
+    //If k came out a digit too high, the first one is a 0 to skip.
+    if(digit || len) buf[len++] = '0' + digit;
+    else k--;
+    if(low || high) break;
+  }
+  dec_exp = k - len;
+}
+
+//Writes an unsigned integer, returns the end of it.
+char* write_uint(uint64_t val, char* out) {
+  char tmp[20];
+  int n = 0;
+  do {
+    tmp[n++] = '0' + val % 10;
+    val /= 10;
+  } while(val);
+  while(n) *out++ = tmp[--n];
+  return out;
+}
+
+//Lays out digits * 10^dec_exp as a JSON number.
+//Plain notation is used between 1e-5 and 1e21, like JavaScript does.
+char* layout(const char* digits, int len, int dec_exp, char* out) {
+  int point = len + dec_exp;
+  if(dec_exp >= 0 && point <= 21) {
+    memcpy(out, digits, len);
+    out += len;
+    for(int i = 0; i < dec_exp; i++) *out++ = '0';
+  } else if(0 < point && point <= 21) {
+    memcpy(out, digits, point);
+    out += point;
+    *out++ = '.';
+    memcpy(out, digits + point, len - point);
+    out += len - point;
+  } else if(-6 < point && point <= 0) {
+    *out++ = '0';
+    *out++ = '.';
+    for(int i = point; i < 0; i++) *out++ = '0';
+    memcpy(out, digits, len);
+    out += len;
+  } else {
+    *out++ = digits[0];
+    if(len > 1) {
+      *out++ = '.';
+      memcpy(out, digits + 1, len - 1);
+      out += len - 1;
+    }
+    *out++ = 'e';
+    int exp = point - 1;
+    if(exp < 0) {
+      *out++ = '-';
+      exp = -exp;
+    } else {
+      *out++ = '+';
+    }
+    out = write_uint(exp, out);
+  }
+  return out;
+}
+
+//Writes the shortest digits that read back as the value with these bits.
+char* shortest(uint64_t fraction, int exponent, int fractionBits, int bias, char* out) {
+  diyfp m_minus, v, m_plus;
+  boundaries(fraction, exponent, fractionBits, bias, m_minus, v, m_plus);
+  cached_power c = power_for_exponent(m_plus.e);
+  diyfp scale = {c.f, c.e};
+  diyfp w = mul(v, scale);
+  diyfp w_minus = mul(m_minus, scale);
+  diyfp w_plus = mul(m_plus, scale);
+  char digits[18];
+  int len = 0;
+  int dec_exp = -c.k;
+  if(!digit_gen(digits, len, dec_exp, w_minus, w, w_plus)) {
+    diyfp exact = unpack(fraction, exponent, fractionBits, bias);
+    exact_digits(exact.f, exact.e, lower_closer(fraction, exponent), digits, len, dec_exp);
+  }
+  return layout(digits, len, dec_exp, out);
+}
+}
+
+char* json::format_number(double val, char* out) {
+  //JSON can't hold these, null is the closest thing.
+  if(!std::isfinite(val)) {
+    memcpy(out, "null", 4);
+    return out + 4;
+  }
+  if(std::signbit(val)) {
+    *out++ = '-';
+    val = -val;
+  }
+  //Whole numbers below 2^53 print exactly as integers.
+  if(val < 9007199254740992.0 && val == (double)(uint64_t)val) {
+    return write_uint((uint64_t)val, out);
+  }
+  uint64_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return shortest(bits & ((uint64_t(1) << 52) - 1), (bits >> 52) & 0x7FF, 52, 1075, out);
+}
+
+char* json::format_float(float val, char* out) {
+  if(!std::isfinite(val)) {
+    memcpy(out, "null", 4);
+    return out + 4;
+  }
+  if(std::signbit(val)) {
+    *out++ = '-';
+    val = -val;
+  }
+  //Past 2^24 floats skip whole numbers, and digits get shorter than the integer.
+  if(val < 16777216.0f && val == (float)(uint32_t)val) {
+    return write_uint((uint32_t)val, out);
+  }
+  uint32_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return shortest(bits & ((1u << 23) - 1), (bits >> 23) & 0xFF, 23, 150, out);
+}
+
+void json::write_number(double val, std::string& out) {
+  char buf[NUMBER_BUFFER_SIZE];
+  out.append(buf, format_number(val, buf) - buf);
+}
@@ -0,0 +1,139 @@
+#include "main.h"
+#include "tabu.hpp"
+#include "json_corpus.hpp"
+#include <cmath>
+
+#ifdef JSON_BENCH
+
+extern "C" {
+  uint64_t vexSystemHighResTimeGet(void);
+}
+
+//Microseconds since startup, for timing benchmarks.
+static uint64_t micros() {
+  return vexSystemHighResTimeGet();
+}
+
+//Controller move messages, like tabicat sends while driving.
+static std::vector<std::string> move_lines(int count) {
+  std::vector<std::string> lines;
+  lines.reserve(count);
+  for(int i = 0; i < count; i++) {
+    std::string line = "=blue_control.move/MV" + std::to_string(100000 + i) + "/{\"axis\":";
+    line += std::to_string(i % 4) + ",\"value\":";
+    json::write_number(std::sin(i / 50.0), line);
+    line += '}';
+    lines.push_back(std::move(line));
+  }
+  return lines;
+}
+
+static json heap_use(const json_heap_use& use) {
+  return json::object({
+    {"allocs", use.allocs < 0 ? json() : json((double)use.allocs)},
+    {"bytes", (double)use.bytes},
+    {"peak", (double)use.peak}
+  });
+}
+
+void init_json_bench() {
+  tabu_reply_on("json_bench.numbers", [](const Message& msg) -> json {
+    int count = msg.field("samples").is_number() ? msg.integer("samples") : 5000;
+    auto result = json_bench_numbers(count, micros);
+    return json::object({
+      {"samples", (double)result.values},
+      {"ostreamUs", result.ostreamUs},
+      {"ostreamBytes", (double)result.ostreamBytes},
+      {"ostreamLossy", result.ostreamLossy},
+      {"writerUs", result.writerUs},
+      {"writerBytes", (double)result.writerBytes}
+    });
+  });
+  tabu_help("json_bench.numbers", {
+    tlabel("Times number formatting, old ostringstream path vs json::write_number."),
+    tnum("samples"),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  tabu_reply_on("json_bench.sax", [](const Message& msg) -> json {
+    int count = msg.field("messages").is_number() ? msg.integer("messages") : 1000;
+    auto lines = move_lines(count);
+    double axes[4] = {};
+    //Full DOM, what a tabu_on listener gets.
+    auto begin = micros();
+    for(auto& line: lines) {
+      Message move(line);
+      axes[move.integer("axis")] = move.number("value");
+    }
+    auto domTime = micros() - begin;
+    //Events, what a tabu_on_raw listener does.
+    begin = micros();
+    for(auto& line: lines) {
+      Message move(line, Message::DEFER_CONTENT);
+      json_fields fields({"axis", "value"});
+      json::parse_events(move.raw, fields);
+      axes[(int)fields.get(0)] = fields.get(1);
+    }
+    auto saxTime = micros() - begin;
+    return json::object({
+      {"messages", count},
+      {"domUs", (double)domTime},
+      {"saxUs", (double)saxTime},
+      //Uses what was read, so none of it can be optimized away.
+      {"checksum", axes[0] + axes[1] + axes[2] + axes[3]}
+    });
+  });
+  tabu_help("json_bench.sax", {
+    tlabel("Times blue_control.move handling, full json vs parse_events."),
+    tnum("messages"),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  tabu_reply_on("json_bench.corpus", [](const Message& msg) -> json {
+    //Sizes are topics, samples, messages and depth, in corpus order.
+    static const int defaultSizes[] = {60, 5000, 1000, 32};
+    int size = 0, passes = 3;
+    msg.try_integer("size", size);
+    msg.try_integer("passes", passes);
+    json ret = json::object({});
+    for(int kind = 0; json_corpus_name(kind); kind++) {
+      auto docs = json_corpus((json_corpus_kind)kind, size > 0 ? size : defaultSizes[kind]);
+      auto result = json_bench(docs, passes, micros);
+      ret[json_corpus_name(kind)] = json::object({
+        {"docs", (double)result.docs},
+        {"bytes", (double)result.bytes},
+        {"parseMBs", result.parse_rate()},
+        {"writeMBs", result.write_rate()},
+        {"parseHeap", heap_use(result.parseHeap)},
+        {"writeHeap", heap_use(result.writeHeap)}
+      });
+    }
+    return ret;
+  });
+  tabu_help("json_bench.corpus", {
+    tlabel("Times json parse and write over the json_corpus documents (help registry, graph replies, move storm, nesting)."),
+    tnum("size", "size (0 for defaults)"),
+    tnum("passes"),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  tabu_reply_on("json_bench.fuzz", [](const Message& msg) -> json {
+    int runs = 2000, seed = 1;
+    msg.try_integer("runs", runs);
+    msg.try_integer("seed", seed);
+    auto begin = micros();
+    auto result = json_fuzz(json_fuzz_seeds(), runs, seed);
+    return json::object({
+      {"runs", result.runs},
+      {"valid", result.valid},
+      {"failures", result.failures},
+      {"failure", result.failure ? json(result.failure) : json()},
+      {"input", result.failures ? json(result.failedInput) : json()},
+      {"us", (double)(micros() - begin)}
+    });
+  });
+  tabu_help("json_bench.fuzz", {
+    tlabel("Fuzzes the json parsers against each other, see json_corpus.hpp."),
+    tnum("runs"), tnum("seed"),
+    treplyaction("say(JSON.stringify(it))")
+  });
+}
+
+#endif
@@ -0,0 +1,5 @@
+#pragma once
+//The json_bench tabu topics, for timing json on the brain itself. Only
+//built in with -DJSON_BENCH (see the Makefile), so they aren't in normal
+//builds where any tabu client could set them off.
+void init_json_bench();
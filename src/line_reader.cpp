@@ -0,0 +1,53 @@
+#include "line_reader.hpp"
+#include <cstring>
+
+//Room for a whole line, plus a read's worth past it.
+static const size_t READ_ROOM = 512;
+
+LineReader::LineReader(ReadFn read, size_t maxLine):
+  read(read), maxLine(maxLine), buf(new char[maxLine + READ_ROOM]), size(maxLine + READ_ROOM) {}
+
+void LineReader::more() {
+  if(start) {
+    memmove(buf.get(), buf.get() + start, fill - start);
+    fill -= start;
+    scanned -= start;
+    start = 0;
+  }
+  int got = read(buf.get() + fill, size - fill);
+  if(got <= 0) return;
+  reads++;
+  fill += got;
+}
+
+std::string_view LineReader::next() {
+  while(true) {
+    auto found = (char*)memchr(buf.get() + scanned, '\n', fill - scanned);
+    if(!found) {
+      scanned = fill;
+      if(skipping) {
+        //None of it is wanted, the rest of the line can go where it was.
+        start = scanned = fill = 0;
+      } else if(fill - start > maxLine) {
+        tooLong++;
+        skipping = true;
+        start = scanned = fill = 0;
+      }
+      more();
+      continue;
+    }
+    size_t end = found - buf.get();
+    std::string_view line(buf.get() + start, end - start);
+    start = scanned = end + 1;
+    if(skipping) {
+      skipping = false;
+      continue;
+    }
+    if(line.size() > maxLine) {
+      tooLong++;
+      continue;
+    }
+    lines++;
+    return line;
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+//Splits a byte stream into lines, reading as much as there is at a time
+//into one fixed buffer instead of a byte at a time. Lines are handed out
+//as views into the buffer, so reading doesn't allocate. Doesn't need the
+//robot, the stream is whatever read function it's given.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+class LineReader {
+  public:
+  //Fills buf with up to size bytes and returns how many, or <= 0 if
+  //there's nothing yet. Can block until there's something.
+  using ReadFn = int (*)(char* buf, size_t size);
+  LineReader(ReadFn read, size_t maxLine);
+  //Waits for the next whole line, without the '\n'. A '\r' before it is
+  //left for the caller, since tabu frames can end in one. The view is
+  //only good until next is called again. Lines longer than maxLine
+  //are skipped over without being kept.
+  std::string_view next();
+  //Counts since this was made.
+  uint32_t lines = 0;
+  uint32_t tooLong = 0;
+  uint32_t reads = 0;
+  private:
+  ReadFn read;
+  size_t maxLine;
+  std::unique_ptr<char[]> buf;
+  size_t size;
+  //buf holds [start, fill), with no '\n' in [start, scanned).
+  size_t start = 0;
+  size_t scanned = 0;
+  size_t fill = 0;
+  //Set while throwing away a line that was too long.
+  bool skipping = false;
+  //Waits for more bytes, making room for them first.
+  void more();
+};
@@ -0,0 +1,90 @@
+#pragma once
+//The ring tabu's output lines go through on their way to serial. Doesn't
+//need the robot, so it builds on a host too.
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+//Lines waiting to go out over serial. Any task can add a line without
+//a lock, and a writer task takes them off and writes them in batches,
+//so nobody waits on the serial port but the writer.
+//This is Dmitry Vyukov's bounded queue: each slot's seq says whose turn
+//it is, pos when it's free to fill for pos, pos + 1 once it's filled.
+//Slot strings are swapped with the writer's, never freed, so once
+//they've grown copying a line in doesn't allocate. Lines are formatted
+//before a slot is claimed, a slot can't be given back once it is.
+class OutputRing {
+  public:
+  //How many lines it holds.
+  static const uint32_t SIZE = 64;
+  private:
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    std::string line;
+    //Whether it goes out as a frame, see tabu_frame.hpp.
+    bool framed;
+    //Set if the line couldn't be copied in, the writer passes over it.
+    bool skipped;
+  };
+  Slot slots[SIZE];
+  std::atomic<uint32_t> fillPos{0};
+  //Only the writer changes it, but anyone can ask how much is waiting.
+  std::atomic<uint32_t> takePos{0};
+  public:
+  OutputRing() {
+    for(uint32_t i = 0; i < SIZE; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+  //False if the ring is full.
+  bool try_add(bool framed, std::string_view line) {
+    uint32_t pos = fillPos.load(std::memory_order_relaxed);
+    Slot* slot;
+    while(true) {
+      slot = &slots[pos % SIZE];
+      int32_t diff = slot->seq.load(std::memory_order_acquire) - pos;
+      if(diff == 0) {
+        if(fillPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if(diff < 0) {
+        return false;
+      } else {
+        pos = fillPos.load(std::memory_order_relaxed);
+      }
+    }
+    slot->framed = framed;
+    slot->skipped = false;
+    try {
+      slot->line.assign(line.data(), line.size());
+    } catch(...) {
+      //Only if it's out of memory. The slot's been claimed and the
+      //writer waits on it, so it's handed over anyway, marked skipped.
+      slot->skipped = true;
+      slot->seq.store(pos + 1, std::memory_order_release);
+      throw;
+    }
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+  //Only the writer calls this. Swaps the next line into line, passing
+  //over skipped ones.
+  bool take(std::string& line, bool& framed) {
+    while(true) {
+      uint32_t pos = takePos.load(std::memory_order_relaxed);
+      auto& slot = slots[pos % SIZE];
+      if((int32_t)(slot.seq.load(std::memory_order_acquire) - (pos + 1)) < 0) return false;
+      bool skipped = slot.skipped;
+      if(!skipped) {
+        line.swap(slot.line);
+        framed = slot.framed;
+      }
+      slot.seq.store(pos + SIZE, std::memory_order_release);
+      takePos.store(pos + 1, std::memory_order_release);
+      if(!skipped) return true;
+    }
+  }
+  uint32_t waiting() const {
+    //takePos first, so fillPos can't be older than it and come out behind.
+    uint32_t taken = takePos.load(std::memory_order_relaxed);
+    return fillPos.load(std::memory_order_relaxed) - taken;
+  }
+};
@@ -4,6 +4,7 @@
 #include "opcontrol.hpp"
 #include "mtrs.hpp"
 #include "automation_util.hpp"
+#include "json_bind.hpp"
 
 struct PIDDataPoint {
   double time;
@@ -14,6 +15,18 @@ struct PIDDataPoint {
   double step;
 };
 
+template<> struct json_bind<PIDDataPoint> {
+  static constexpr json_bound_field fields[] = {
+    json_field<&PIDDataPoint::time>("time"),
+    json_field<&PIDDataPoint::error>("error"),
+    json_field<&PIDDataPoint::p>("p"),
+    json_field<&PIDDataPoint::i>("i"),
+    json_field<&PIDDataPoint::d>("d"),
+    json_field<&PIDDataPoint::step>("step")
+  };
+  static constexpr json_binding binding = {fields, std::size(fields)};
+};
+
 class TestingController: public okapi::IterativePosPIDController {
   public:
   TestingController(
@@ -36,7 +49,7 @@ class TestingController: public okapi::IterativePosPIDController {
 };
 
 void init_pid_test() {
-  tabu_reply_on("pid_test", [](Message msg) -> json {
+  tabu_reply_written_on("pid_test", [](const Message& msg, std::string& reply) {
     puts(msg.content.to_string().c_str());
     printf("hi\n");
     pauseControl();
@@ -80,21 +93,14 @@ void init_pid_test() {
       returnToWall();
     }
     resumeControl();
-    auto jarr = json::array({});
-    for(auto& entry: collectedData) {
-      jarr.array_data().push_back(json::object({
-        {"time", entry.time},
-        {"error", entry.error},
-        {"p", entry.p},
-        {"i", entry.i},
-        {"d", entry.d},
-        {"step", entry.step}
-      }));
+    reply += "{\"graphable\":";
+    if(msg.flag("columnar")) {
+      json_table_of(collectedData).to_columns(true).write(reply);
+    } else {
+      json_write(collectedData, reply);
     }
-    return json::object({
-      {"graphable", jarr}
-    });
-  });
+    reply += '}';
+  }, OWN_TASK);
   tabu_help("pid_test", {
     tlabel("Do a PID test"),
     tnum("kP"), tnum("kI"), tnum("kD"), tnum("kBias"),
@@ -103,6 +109,7 @@ void init_pid_test() {
     tbool("useVoltage"),
     tbool("turn"),
     tnum("revs"),
+    tbool("columnar"),
     treplyaction("graph(it.graphable)")
   });
 }
\ No newline at end of file
@@ -2,174 +2,812 @@
 #include "tabu.hpp"
 #include "entropy.hpp"
 #include "superhot_compat.hpp"
+#include "pros/apix.h"
+#include "line_reader.hpp"
+#include "tabu_frame.hpp"
+#include "output_ring.hpp"
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <map>
 
-//Creates a random alphanumeric string of length len.
-std::string makeid(int len) {
-  std::string ret;
-  static const char alphanum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-  for (int i = 0; i < len; i++) {
-    ret += alphanum[get_random() % (sizeof(alphanum) - 1)];
+static const char alphanum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+const uint32_t ID_PREFIX_SIZE = 3;
+const uint32_t ID_COUNTER_SIZE = 5;
+//Random per boot, so ids from before a restart aren't mistaken for new
+//ones. 0 until the first id is made.
+std::atomic<uint32_t> idPrefix{0};
+std::atomic<uint32_t> idCounter{0};
+
+//Makes the next message id, 8 alphanumeric characters like they've
+//always been: a per-boot prefix, then a counter. It takes 62^5 (over
+//900 million) messages before the counter comes back around, and no
+//lock or RNG is needed after the first one.
+void next_message_id(std::string& out) {
+  uint32_t prefix = idPrefix.load(std::memory_order_relaxed);
+  if(!prefix) {
+    //Whoever gets here first sets it, everyone else uses theirs.
+    uint32_t made = (uint32_t)get_random() % (62 * 62 * 62) + 1;
+    if(!idPrefix.compare_exchange_strong(prefix, made)) made = prefix;
+    prefix = made;
+  }
+  uint32_t count = idCounter.fetch_add(1, std::memory_order_relaxed);
+  char text[ID_PREFIX_SIZE + ID_COUNTER_SIZE];
+  prefix--;
+  for(int i = ID_PREFIX_SIZE - 1; i >= 0; i--) {
+    text[i] = alphanum[prefix % 62];
+    prefix /= 62;
+  }
+  for(int i = ID_PREFIX_SIZE + ID_COUNTER_SIZE - 1; i >= (int)ID_PREFIX_SIZE; i--) {
+    text[i] = alphanum[count % 62];
+    count /= 62;
+  }
+  out.assign(text, sizeof(text));
+}
+
+class TabuLock {
+  bool taken = false;
+  public:
+  TabuLock() {
+    take();
+  }
+  ~TabuLock() {
+    if(taken) give();
+  }
+  void give() {
+    tabu_lock.give();
+    taken = false;
+  }
+  void take() {
+    bool wasTaken = tabu_lock.take(500);
+    if(!wasTaken) {
+      std::cerr << "We've got a problem." << std::endl;
+      char *badPtr = nullptr;
+      *badPtr = '#';
+    }
+    taken = true;
+  }
+};
+
+// ----- Content encoding -----
+
+//Starts content that's base64 CBOR. JSON text never starts with it.
+const char BINARY_CONTENT = '~';
+ContentEncoding tabuEncoding = JSON_CONTENT;
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void base64_encode(std::string_view data, std::string& out) {
+  size_t i = 0;
+  for(; i + 3 <= data.size(); i += 3) {
+    uint32_t n = (uint8_t)data[i] << 16 | (uint8_t)data[i + 1] << 8 | (uint8_t)data[i + 2];
+    out += base64Chars[n >> 18];
+    out += base64Chars[(n >> 12) & 63];
+    out += base64Chars[(n >> 6) & 63];
+    out += base64Chars[n & 63];
+  }
+  size_t left = data.size() - i;
+  if(left) {
+    uint32_t n = (uint8_t)data[i] << 16 | (left == 2 ? (uint8_t)data[i + 1] << 8 : 0);
+    out += base64Chars[n >> 18];
+    out += base64Chars[(n >> 12) & 63];
+    out += left == 2 ? base64Chars[(n >> 6) & 63] : '=';
+    out += '=';
   }
-  return ret;
+}
+
+//Appends the bytes text holds onto out. False if it isn't base64.
+bool base64_decode(std::string_view text, std::string& out) {
+  out.reserve(out.size() + text.size() / 4 * 3);
+  uint32_t bits = 0;
+  int count = 0;
+  for(char c: text) {
+    int val;
+    if(c >= 'A' && c <= 'Z') val = c - 'A';
+    else if(c >= 'a' && c <= 'z') val = c - 'a' + 26;
+    else if(c >= '0' && c <= '9') val = c - '0' + 52;
+    else if(c == '+') val = 62;
+    else if(c == '/') val = 63;
+    else if(c == '=') break;
+    else return false;
+    bits = bits << 6 | val;
+    count += 6;
+    if(count >= 8) {
+      count -= 8;
+      out += (char)(bits >> count);
+    }
+  }
+  return true;
+}
+
+void tabu_set_encoding(ContentEncoding encoding) {
+  tabuEncoding = encoding;
+}
+
+void tabu_write_content(const json& content, std::string& out) {
+  if(tabuEncoding == CBOR_CONTENT) {
+    std::string binary;
+    content.write_cbor(binary);
+    out += BINARY_CONTENT;
+    out.reserve(out.size() + (binary.size() + 2) / 3 * 4);
+    base64_encode(binary, out);
+  } else {
+    content.write(out);
+  }
+}
+
+//Content of msg the way it'd be sent. Written content only has to be
+//turned back into json when it's going out as CBOR.
+static void write_message_content(const Message& msg, std::string& out) {
+  if(msg.written.empty()) tabu_write_content(msg.content, out);
+  else if(tabuEncoding == CBOR_CONTENT) tabu_write_content(json::parse(msg.written), out);
+  else out += msg.written;
+}
+
+bool is_binary_content(std::string_view raw) {
+  return !raw.empty() && raw[0] == BINARY_CONTENT;
+}
+
+//Turns ~ and base64 CBOR back into a json.
+json parse_binary_content(std::string_view raw, json_parse_error& error) {
+  std::string binary;
+  if(!base64_decode(raw.substr(1), binary)) {
+    error = {"Bad base64 content", 0};
+    return json();
+  }
+  return json::try_parse_cbor(binary, error);
 }
 
 //Makes an empty message object with a new ID.
 Message::Message() {
-    id = makeid(8);
+    next_message_id(id);
     content = json::object({});
 }
 
+Message::Message(const Message& orig):
+  addressKind(orig.addressKind), address(orig.address), id(orig.id),
+  arena(orig.arena), raw(orig.raw), deferred(orig.deferred),
+  //Content that's in the arena can be shared, since we share the arena too.
+  content(arena ? orig.content.shallow_copy() : orig.content), written(orig.written) {}
+
+Message& Message::operator=(const Message& orig) {
+  if(this == &orig) return *this;
+  Message copy(orig);
+  return *this = std::move(copy);
+}
+
+const json& Message::field(std::string_view key) const {
+  static const json missing;
+  auto val = content.try_get(key);
+  return val ? *val : missing;
+}
+
 //Parses a message object from a message string.
 //The caller is expected to base64-decode the
 //incoming message. The inverse of the text() method.
-Message::Message(const std::string& text) {
+//The line is kept in the message's arena, and content is parsed into it
+//unless parsing is DEFER_CONTENT.
+Message::Message(std::string line, ContentParsing parsing): arena(std::make_shared<json_arena>()) {
+  json_parse_error error;
+  if(!read(std::move(line), parsing, error)) {
+    throw std::runtime_error(error.message());
+  }
+}
+
+Message::Message(std::string line, ContentParsing parsing, json_parse_error& error): arena(std::make_shared<json_arena>()) {
+  read(std::move(line), parsing, error);
+}
+
+bool Message::read(std::string line, ContentParsing parsing, json_parse_error& error) {
+  auto text = arena->adopt(std::move(line));
+  if(text.empty()) {
+    error = {"Empty message.", 0};
+    return false;
+  }
   if(text[0] == '=') {
     addressKind = EVENT;
   } else if(text[0] == '@') {
     addressKind = REPLY;
   } else {
-    throw std::runtime_error("No such address kind.");
+    error = {"No such address kind.", 0};
+    return false;
   }
-  auto addressEnd = text.find_first_of('/');
-  if(addressEnd == text.size()) {
-    throw std::runtime_error("No delimeter.");
+  auto addressEnd = text.find('/');
+  if(addressEnd == std::string_view::npos) {
+    error = {"No delimeter.", text.size()};
+    return false;
+  }
+  auto rawAddress = text.substr(1, addressEnd - 1);
+  if(rawAddress.find('\\') == std::string_view::npos) {
+    address = std::string(rawAddress);
+  } else {
+    //Really hacky way to parse out any \u0070's that pop up in the address
+    json unescaped = json::try_parse("\"" + std::string(rawAddress) + "\"", error);
+    if(error) return false;
+    address = unescaped.get_string();
   }
-  //Really hacky way to parse out any \u0070's that pop up in the address
-  address = json::parse("\"" + text.substr(1, addressEnd - 1) + "\"").get_string();
   addressEnd++;
-  auto idEnd = text.find_first_of('/', addressEnd);
-  auto idLen = idEnd - addressEnd;
-  id = text.substr(addressEnd, idLen);
-  idEnd++;
-  content = json::parse(text.substr(idEnd));
+  auto idEnd = text.find('/', addressEnd);
+  if(idEnd == std::string_view::npos) {
+    error = {"No delimeter.", text.size()};
+    return false;
+  }
+  id = std::string(text.substr(addressEnd, idEnd - addressEnd));
+  raw = text.substr(idEnd + 1);
+  deferred = true;
+  if(parsing == PARSE_CONTENT) return try_parse_content(error);
+  return true;
+}
+
+void Message::parse_content() {
+  json_parse_error error;
+  if(!try_parse_content(error)) {
+    throw std::runtime_error(error.message());
+  }
+}
+
+bool Message::try_parse_content(json_parse_error& error) {
+  if(!deferred) return true;
+  if(is_binary_content(raw)) {
+    content = parse_binary_content(raw, error);
+  } else {
+    content = json::try_parse(raw, *arena, error);
+  }
+  if(error) return false;
+  deferred = false;
+  return true;
 }
 
 //Forms a string representing this message.
 //=TOPIC/ID123456/"JSON message data"
 std::string Message::text() {
-  return (addressKind == EVENT ? "=" : "@") + address + "/" + id + "/" + content.to_string();
+  std::string ret;
+  text(ret);
+  return ret;
+}
+
+//Appends the text() of this message onto out.
+void Message::text(std::string& out) {
+  out += (addressKind == EVENT ? '=' : '@');
+  out += address;
+  out += '/';
+  out += id;
+  out += '/';
+  write_message_content(*this, out);
+}
+
+// ----- Output ring -----
+
+OutputRing outputRing;
+std::atomic<pros::task_t> outputWriter{nullptr};
+std::atomic<uint32_t> linesWritten{0};
+std::atomic<uint32_t> linesDropped{0};
+std::atomic<uint32_t> linesWaited{0};
+std::atomic<uint32_t> mostWaiting{0};
+//Set by the "tabu.framing" topic. Lines added after it's set are framed.
+std::atomic<bool> framedOutput{false};
+uint16_t nextFrameSeq = 0;
+
+//Writes everything in the ring, a batch at a time, then sleeps until
+//someone adds more.
+void output_writer(void*) {
+  std::string line;
+  std::string batch;
+  bool framed;
+  const size_t BATCH_SIZE = 1024;
+  while(true) {
+    while(outputRing.take(line, framed)) {
+      if(framed) tabu_frame(line, nextFrameSeq++, batch);
+      else batch += line;
+      batch += '\n';
+      linesWritten++;
+      if(batch.size() >= BATCH_SIZE) {
+        fwrite(batch.data(), 1, batch.size(), stdout);
+        batch.clear();
+      }
+    }
+    if(!batch.empty()) {
+      fwrite(batch.data(), 1, batch.size(), stdout);
+      batch.clear();
+    }
+    fflush(stdout);
+    //One huge line shouldn't hold on to its memory forever.
+    if(line.capacity() > 4 * BATCH_SIZE) std::string().swap(line);
+    pros::c::task_notify_take(true, 20);
+  }
+}
+
+void tabu_start_output() {
+  if(outputWriter) return;
+  outputWriter = SuperHot::registerTask(pros::Task(output_writer, nullptr, TASK_PRIORITY_DEFAULT, TASK_STACK_DEPTH_DEFAULT, "tabu-output"));
+}
+
+bool tabu_write_line(std::string_view line, TabuOutputPolicy policy) {
+  bool framed = framedOutput;
+  bool added = outputRing.try_add(framed, line);
+  if(!added && policy == WAIT_WHEN_FULL) {
+    linesWaited++;
+    auto deadline = pros::millis() + TABU_OUTPUT_WAIT;
+    while(!added && (int32_t)(pros::millis() - deadline) < 0) {
+      pros::delay(1);
+      added = outputRing.try_add(framed, line);
+    }
+  }
+  if(!added) {
+    linesDropped++;
+    return false;
+  }
+  uint32_t waiting = outputRing.waiting();
+  uint32_t most = mostWaiting;
+  while(waiting > most && !mostWaiting.compare_exchange_weak(most, waiting)) {}
+  //Lines added before the writer starts wait in the ring for it.
+  pros::task_t writer = outputWriter;
+  if(writer) pros::c::task_notify(writer);
+  return true;
 }
 
-//Sends this message over USB serial.
+TabuOutputStats tabu_output_stats() {
+  TabuOutputStats ret;
+  ret.waiting = outputRing.waiting();
+  ret.mostWaiting = mostWaiting;
+  ret.written = linesWritten;
+  ret.dropped = linesDropped;
+  ret.waited = linesWaited;
+  return ret;
+}
+
+//Sends this message over USB serial. It's written out by the output
+//writer, this only waits if there's no room for it. It's formatted
+//first, writing the content can throw.
 void Message::send() {
-  tabu_say(text());
+  tabu_write_line(text(), WAIT_WHEN_FULL);
+}
+
+TabuTransferConfig transferConfig;
+
+void tabu_set_transfer(const TabuTransferConfig& config) {
+  TabuLock lk;
+  transferConfig = config;
+  if(transferConfig.chunkSize < 16) transferConfig.chunkSize = 16;
+  if(transferConfig.window < 1) transferConfig.window = 1;
+  if(transferConfig.maxTries < 1) transferConfig.maxTries = 1;
+}
+
+TabuTransferConfig tabu_transfer_config() {
+  TabuLock lk;
+  return transferConfig;
 }
 
+//A chunk of a bigSend that's been sent but not replied to yet.
+struct OutgoingChunk {
+  //The segment's id, which its reply listener waits on.
+  std::string id;
+  //The whole line, so sending it again doesn't write it again.
+  std::string line;
+  uint32_t sentAt = 0;
+  //Times it's gone into the output ring, and times in a row it didn't
+  //fit. One that didn't fit never went out, so it's sent again either way.
+  int tries = 0;
+  int failedWrites = 0;
+};
+void drop_reply_listeners(const std::deque<OutgoingChunk>& chunks);
+
 //Send this message using in small blocks using the
-//special "file-transfer" topic. As this waits for
-//a response from the receiving device, this will never
-//overflow the serial buffer.
+//special "file-transfer" topic. Up to a window of chunks
+//are out at once and each one is replied to, so this
+//never has more than a window's worth in the serial buffer.
+//Chunks that aren't replied to in time are sent again, the
+//seq numbers let the other end put them back in order. Both of
+//those only happen once the other end has said it knows about seq,
+//until then it's a chunk at a time, and each chunk waits as long as
+//its reply takes, like it always has.
+//The content is encoded once, and chunks of that go out in segments
+//that are always JSON text, since CBOR and base64 around what's already
+//~ and base64 would only make it a third bigger.
 //Note: Sending a big message will block the caller.
 void Message::bigSend() {
-  int bigPos = 0;
-  std::string dataStr = content.to_string();
-  do {
-    auto nextData = dataStr.substr(bigPos, 512);
-    bigPos += nextData.size();
-    Message segment;
-    segment.addressKind = EVENT;
-    segment.address = "file-transfer";
-    segment.content = json::object({
-      {"origId", id},
-      {"origAddr", (addressKind == EVENT ? "=" : "@") + address},
-      {"nextData", nextData},
-      {"done", (bool)(bigPos == dataStr.size())}
-    });
-    segment.send();
-    bool waitingForReply = true;
-    tabu_on(segment, [&](Message reply, Message original) {
-      waitingForReply = false;
-    });
-    while(waitingForReply) {
-      pros::delay(1);
+  auto config = tabu_transfer_config();
+  std::string dataStr;
+  write_message_content(*this, dataStr);
+  size_t count = std::max<size_t>(1, (dataStr.size() + config.chunkSize - 1) / config.chunkSize);
+  //Set by the reply listeners, which can outlive this if a reply is late.
+  auto acked = std::make_shared<std::vector<std::atomic<bool>>>(count);
+  std::deque<OutgoingChunk> inFlight;
+  //Chunks before base are done with, chunks from next on aren't sent yet.
+  size_t base = 0;
+  size_t next = 0;
+  //Replies that come after we've given up are just orphans. Without
+  //peerSeq we never give up, so neither do the listeners.
+  uint32_t replyTimeout = config.peerSeq ? config.retryTimeout * config.maxTries + 1000 : 0;
+  size_t window = config.peerSeq ? config.window : 1;
+  //Listeners for chunks still in flight would wait forever without
+  //peerSeq, so they go when we give up.
+  auto give_up = [&](const char* why, size_t seq) {
+    drop_reply_listeners(inFlight);
+    tabu_say("Gave up sending " + address + ", " + why + " " + std::to_string(seq));
+  };
+  //False if the ring stayed full through maxTries writes in a row, which
+  //means nothing's getting out and there's no point carrying on.
+  auto write = [&](OutgoingChunk& chunk, size_t seq) {
+    if(tabu_write_line(chunk.line, WAIT_WHEN_FULL)) {
+      chunk.sentAt = pros::millis();
+      chunk.tries++;
+      chunk.failedWrites = 0;
+      return true;
     }
-  } while(bigPos < dataStr.size());
+    if(++chunk.failedWrites < config.maxTries) return true;
+    give_up("couldn't write chunk", seq);
+    return false;
+  };
+  while(base < count) {
+    while(next < count && next < base + window) {
+      auto nextData = std::string_view(dataStr).substr(next * config.chunkSize, config.chunkSize);
+      Message segment;
+      segment.addressKind = EVENT;
+      segment.address = "file-transfer";
+      segment.content = json::object({
+        {"origId", id},
+        {"origAddr", (addressKind == EVENT ? "=" : "@") + address},
+        {"seq", (double)next},
+        {"nextData", std::string(nextData)},
+        {"done", next + 1 == count}
+      });
+      tabu_on(segment, [acked, next](const Message& reply, const Message& original) {
+        (*acked)[next] = true;
+      }, false, replyTimeout);
+      OutgoingChunk chunk;
+      chunk.id = segment.id;
+      chunk.line = "=file-transfer/" + segment.id + "/";
+      segment.content.write(chunk.line);
+      inFlight.push_back(std::move(chunk));
+      if(!write(inFlight.back(), next)) return;
+      next++;
+    }
+    while(base < next && (*acked)[base]) {
+      inFlight.pop_front();
+      base++;
+    }
+    auto now = pros::millis();
+    for(size_t i = 0; i < inFlight.size(); i++) {
+      auto& chunk = inFlight[i];
+      if((*acked)[base + i]) continue;
+      if(chunk.failedWrites) {
+        if(!write(chunk, base + i)) return;
+        continue;
+      }
+      if(!config.peerSeq || now - chunk.sentAt < config.retryTimeout) continue;
+      if(chunk.tries == config.maxTries) {
+        give_up("no reply to chunk", base + i);
+        return;
+      }
+      if(!write(chunk, base + i)) return;
+    }
+    if(base < count) pros::delay(1);
+  }
+}
+
+// ----- Worker pool -----
+
+//Async listeners run on a few long-lived tasks, fed through a bounded
+//queue, rather than a new task (and stack) each. When the queue is
+//full the job is turned away, so a storm of messages can't use up
+//memory. Listeners that run for seconds get a task of their own
+//instead (OWN_TASK), so they can't hold up the pool.
+TabuWorkerConfig workerConfig;
+std::atomic<pros::c::queue_t> workerQueue{nullptr};
+std::atomic<int> busyWorkers{0};
+std::atomic<uint32_t> jobsRun{0};
+std::atomic<uint32_t> jobsRejected{0};
+std::atomic<uint32_t> mostQueued{0};
+std::atomic<uint32_t> ownTasks{0};
+
+void tabu_set_workers(const TabuWorkerConfig& config) {
+  TabuLock lk;
+  if(workerQueue) throw std::runtime_error("The tabu workers have already started");
+  workerConfig = config;
+  if(workerConfig.workers < 1) workerConfig.workers = 1;
+  if(workerConfig.queueDepth < 1) workerConfig.queueDepth = 1;
 }
 
-//Runs a callable and copyable type, T, as a pros::Task.
-//This really should be in its own file.
-template<typename T>
-void runLambdaAsync(T copyableRunnable) {
-  T* copy = new T(copyableRunnable);
+void tabu_worker(void*) {
+  while(true) {
+    std::function<void()>* job;
+    if(!pros::c::queue_recv(workerQueue, &job, TIMEOUT_MAX)) continue;
+    busyWorkers++;
+    try {
+      (*job)();
+    } catch(...) {
+      printf("Caught an exception in a tabu worker\n");
+    }
+    delete job;
+    busyWorkers--;
+    jobsRun++;
+  }
+}
+
+//Starts the workers the first time there's a job for them.
+pros::c::queue_t start_workers() {
+  TabuLock lk;
+  if(!workerQueue) {
+    workerQueue = pros::c::queue_create(workerConfig.queueDepth, sizeof(std::function<void()>*));
+    for(int i = 0; i < workerConfig.workers; i++) {
+      SuperHot::registerTask(pros::Task(tabu_worker, nullptr, workerConfig.priority, workerConfig.stackDepth, "tabu-worker"));
+    }
+  }
+  return workerQueue;
+}
+
+//Runs job on a task of its own, the way every async listener used to.
+void run_own_task(std::function<void()> job) {
+  auto param = new std::function<void()>(std::move(job));
+  ownTasks++;
   SuperHot::registerTask(pros::Task([](void* param) {
-    T innerCopy = T(*((T*)param));
-    delete (T*)param;
-    innerCopy();
-  }, copy, "runLambdaAsync"));
+    std::unique_ptr<std::function<void()>> job((std::function<void()>*)param);
+    try {
+      (*job)();
+    } catch(...) {
+      printf("Caught an exception in a tabu task\n");
+    }
+  }, param, "tabu-own-task"));
 }
 
-class TabuLock {
-  bool taken = false;
-  public:
-  TabuLock() {
-    take();
+//False if the job was turned away, see tabu_run_async.
+bool run_async(std::function<void()> job, TabuRunOn runOn) {
+  if(runOn == OWN_TASK) {
+    run_own_task(std::move(job));
+    return true;
   }
-  ~TabuLock() {
-    if(taken) give();
+  pros::c::queue_t queue = workerQueue;
+  if(!queue) queue = start_workers();
+  auto queued = new std::function<void()>(std::move(job));
+  if(!pros::c::queue_append(queue, &queued, 0)) {
+    delete queued;
+    jobsRejected++;
+    printf("Tabu workers are backed up, turned a job away\n");
+    return false;
   }
-  void give() {
-    tabu_lock.give();
-    taken = false;
+  uint32_t waiting = pros::c::queue_get_waiting(queue);
+  uint32_t most = mostQueued;
+  while(waiting > most && !mostQueued.compare_exchange_weak(most, waiting)) {}
+  return true;
+}
+
+bool tabu_run_async(std::function<void()> job, TabuRunOn runOn) {
+  return run_async(std::move(job), runOn);
+}
+
+TabuWorkerStats tabu_worker_stats() {
+  TabuWorkerStats ret;
+  ret.workers = workerConfig.workers;
+  ret.queueDepth = workerConfig.queueDepth;
+  ret.queued = workerQueue ? pros::c::queue_get_waiting(workerQueue) : 0;
+  ret.mostQueued = mostQueued;
+  ret.busy = busyWorkers;
+  ret.run = jobsRun;
+  ret.rejected = jobsRejected;
+  ret.ownTasks = ownTasks;
+  return ret;
+}
+
+//Storage for topic listeners, looked up by topic. Each topic's lists
+//are never changed once made, adding a listener swaps in a new list,
+//so dispatch can keep hold of them after letting go of the lock.
+//Listeners are held by pointer, so neither growing a list nor handing
+//a message to an async listener copies the function.
+template<typename Listener>
+using ListenerPtr = std::shared_ptr<const Listener>;
+template<typename Listener>
+using ListenerList = std::shared_ptr<const std::vector<ListenerPtr<Listener>>>;
+struct TopicListeners {
+  ListenerList<std::function<void(const Message&)>> listeners;
+  ListenerList<std::function<void(const Message&, std::string_view)>> raw;
+};
+std::unordered_map<std::string, TopicListeners> topicListeners;
+
+//Subscriptions with wildcards in them, by dotted part. A "*" part
+//matches any one part, and a "#" at the end matches whatever's left,
+//even nothing. So "blue_control.*" gets blue_control.move and
+//blue_control.key, and "simple_follower.#" gets everything under
+//simple_follower. Finding the matches for a topic walks it a part at a
+//time, so it costs about its depth however many listeners there are.
+//Plain topics stay in topicListeners.
+struct TopicNode {
+  std::string name;
+  //Keyed by views of the children's names, so finding one doesn't need
+  //a string made.
+  std::unordered_map<std::string_view, std::unique_ptr<TopicNode>> children;
+  std::unique_ptr<TopicNode> any;
+  //Patterns that end here, and ones that end here with a "#".
+  TopicListeners here;
+  TopicListeners rest;
+};
+TopicNode topicPatterns;
+bool anyTopicPatterns = false;
+
+bool is_topic_pattern(std::string_view topic) {
+  while(true) {
+    auto dot = topic.find('.');
+    auto part = topic.substr(0, dot);
+    if(part == "*" || part == "#") return true;
+    if(dot == std::string_view::npos) return false;
+    topic.remove_prefix(dot + 1);
   }
-  void take() {
-    bool wasTaken = tabu_lock.take(500);
-    if(!wasTaken) {
-      std::cerr << "We've got a problem." << std::endl;
-      char *badPtr = nullptr;
-      *badPtr = '#';
+}
+
+TopicListeners& pattern_listeners(std::string_view pattern) {
+  TopicNode* node = &topicPatterns;
+  while(true) {
+    auto dot = pattern.find('.');
+    auto part = pattern.substr(0, dot);
+    if(part == "#") {
+      if(dot != std::string_view::npos) throw std::runtime_error("# has to be the last part of a topic");
+      return node->rest;
     }
-    taken = true;
+    if(part == "*") {
+      if(!node->any) node->any = std::make_unique<TopicNode>();
+      node = node->any.get();
+    } else {
+      auto found = node->children.find(part);
+      if(found == node->children.end()) {
+        auto child = std::make_unique<TopicNode>();
+        child->name = part;
+        std::string_view key = child->name;
+        found = node->children.emplace(key, std::move(child)).first;
+      }
+      node = found->second.get();
+    }
+    if(dot == std::string_view::npos) return node->here;
+    pattern.remove_prefix(dot + 1);
   }
-};
+}
+
+//Where listeners for topic go, which might be a pattern. Needs TabuLock.
+TopicListeners& topic_listeners(const std::string& topic) {
+  if(!is_topic_pattern(topic)) return topicListeners[topic];
+  anyTopicPatterns = true;
+  return pattern_listeners(topic);
+}
+
+template<typename Listener>
+void add_listener(ListenerList<Listener>& list, Listener listener) {
+  using Grown = std::vector<ListenerPtr<Listener>>;
+  auto grown = list ? std::make_shared<Grown>(*list) : std::make_shared<Grown>();
+  grown->push_back(std::make_shared<const Listener>(std::move(listener)));
+  list = std::move(grown);
+}
 
-//Storage for topic listeners.
-std::vector<std::pair<std::string, std::function<void(Message)>>> topicListeners;
-void push_topic(const std::string& topic, std::function<void(Message)> listener) {
+void push_topic(const std::string& topic, std::function<void(const Message&)> listener) {
   TabuLock lk;
-  topicListeners.push_back({topic, listener});
+  add_listener(topic_listeners(topic).listeners, std::move(listener));
 }
 //The provided function will be called when the given topic is received.
+//The topic can have wildcards in it, see TopicNode.
 //Setting async = true makes the function run in the background.
-void tabu_on(const std::string& topic, std::function<void(Message)> listener, bool async) {
+void tabu_on(const std::string& topic, std::function<void(const Message&)> listener, bool async) {
   if(async) {
-    auto sync = listener;
-    listener = [=](Message notif) {
-      runLambdaAsync([=]() {
-        sync(notif);
-      });
+    auto sync = std::make_shared<const std::function<void(const Message&)>>(std::move(listener));
+    //The job needs its own copy of the message, it's gone once dispatch
+    //returns, but the function is shared.
+    listener = [sync](const Message& notif) {
+      run_async([sync, notif]() {
+        (*sync)(notif);
+      }, POOLED);
     };
   }
   push_topic(topic, std::move(listener));
 }
 
-using ReplyListener = std::pair<Message, std::function<void(Message, Message)>>;
-//Storage for reply listeners.
-std::vector<ReplyListener> replyListeners;
-//Orphans occur when a reply is received before a reply listener is registered.
-std::vector<Message> orphanReplies;
-void push_reply(Message msg, std::function<void(Message, Message)> listener) {
+void tabu_on_raw(const std::string& topic, std::function<void(const Message&, std::string_view)> listener) {
   TabuLock lk;
-  for(int i = 0; i < orphanReplies.size(); i++) {
-    if(orphanReplies[i].address == msg.id) {
-      listener(orphanReplies[i], msg);
-      orphanReplies.erase(orphanReplies.begin() + i);
-      return;
+  add_listener(topic_listeners(topic).raw, std::move(listener));
+}
+
+struct ReplyListener {
+  Message original;
+  ListenerPtr<std::function<void(const Message&, const Message&)>> listener;
+  //Only for listeners given a timeout, the rest wait forever.
+  bool expires;
+  uint32_t deadline;
+};
+//Storage for reply listeners, by the id of the message they're waiting
+//on a reply to.
+std::unordered_multimap<std::string, ReplyListener> replyListeners;
+//Orphans occur when a reply is received before a reply listener is registered.
+//They're kept, by the id they reply to, for a little while in case the
+//listener is just about to be added, and there can only be so many.
+struct OrphanReply {
+  Message reply;
+  uint32_t deadline;
+};
+std::unordered_map<std::string, OrphanReply> orphanReplies;
+const uint32_t ORPHAN_TIMEOUT = 2000;
+const size_t MAX_ORPHANS = 32;
+TabuReplyStats replyStats;
+uint32_t nextReplySweep = 0;
+
+//Drops listeners and orphans past their deadlines. Only looks through
+//them all once a second. Needs TabuLock.
+void sweep_replies() {
+  uint32_t now = pros::millis();
+  if((int32_t)(now - nextReplySweep) < 0) return;
+  nextReplySweep = now + 1000;
+  for(auto it = replyListeners.begin(); it != replyListeners.end();) {
+    if(it->second.expires && (int32_t)(now - it->second.deadline) >= 0) {
+      //Not printf, which can block on serial while we hold TabuLock.
+      tabu_say("No reply to " + it->second.original.address + " in time");
+      replyStats.timeouts++;
+      it = replyListeners.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for(auto it = orphanReplies.begin(); it != orphanReplies.end();) {
+    if((int32_t)(now - it->second.deadline) >= 0) {
+      replyStats.orphansExpired++;
+      it = orphanReplies.erase(it);
+    } else {
+      ++it;
     }
   }
-  replyListeners.push_back({msg, listener});
+}
+
+void push_reply(const Message& msg, std::function<void(const Message&, const Message&)> listener, uint32_t timeout) {
+  TabuLock lk;
+  sweep_replies();
+  auto orphan = orphanReplies.find(msg.id);
+  if(orphan == orphanReplies.end()) {
+    auto shared = std::make_shared<const std::function<void(const Message&, const Message&)>>(std::move(listener));
+    replyListeners.emplace(msg.id, ReplyListener{msg, std::move(shared), timeout != 0, pros::millis() + timeout});
+    return;
+  }
+  //The listener gets called without the lock, it might well want it.
+  Message reply = std::move(orphan->second.reply);
+  orphanReplies.erase(orphan);
+  lk.give();
+  listener(reply, msg);
 }
 //The provided function will be called when the given message ID is replied to.
 //Setting async = true makes the function run in the background.
-void tabu_on(Message msg, std::function<void(Message, Message)> listener, bool async) {
+//With a timeout, the listener is dropped if there's no reply within
+//that many milliseconds. 0 waits forever.
+void tabu_on(const Message& msg, std::function<void(const Message&, const Message&)> listener, bool async, uint32_t timeout) {
   if(async) {
-    auto sync = listener;
-    listener = [=](Message reply, Message original) {
-      runLambdaAsync([=]() {
-        sync(reply, original);
-      });
+    auto sync = std::make_shared<const std::function<void(const Message&, const Message&)>>(std::move(listener));
+    listener = [sync](const Message& reply, const Message& original) {
+      run_async([sync, reply, original]() {
+        (*sync)(reply, original);
+      }, POOLED);
     };
   }
-  push_reply(msg, std::move(listener));
+  push_reply(msg, std::move(listener), timeout);
+}
+
+//The reply a request gets when its job was turned away, so the other
+//end isn't left waiting for one that'll never come.
+void reply_busy(const Message& request) {
+  tabu_send(request, json::object({{"error", "busy"}}));
+}
+
+void tabu_on_request(const std::string& topic, std::function<void(const Message&)> listener, TabuRunOn runOn) {
+  auto shared = std::make_shared<const std::function<void(const Message&)>>(std::move(listener));
+  push_topic(topic, [shared, runOn](const Message& request) {
+    if(!run_async([shared, request]() { (*shared)(request); }, runOn)) reply_busy(request);
+  });
+}
+
+void tabu_on_request(const Message& repliedTo, std::function<void(const Message&, const Message&)> listener, TabuRunOn runOn) {
+  auto shared = std::make_shared<const std::function<void(const Message&, const Message&)>>(std::move(listener));
+  push_reply(repliedTo, [shared, runOn](const Message& reply, const Message& original) {
+    if(!run_async([shared, reply, original]() { (*shared)(reply, original); }, runOn)) reply_busy(reply);
+  }, 0);
+}
+
+TabuReplyStats tabu_reply_stats() {
+  TabuLock lk;
+  auto ret = replyStats;
+  ret.waiting = replyListeners.size();
+  ret.orphans = orphanReplies.size();
+  return ret;
 }
 
 json helpRegistry = json::object({});
@@ -189,7 +827,7 @@ Message tabu_send(const std::string& topic, json content) {
 }
 
 //Constructs and sends a REPLY message object.
-Message tabu_send(Message message, json content) {
+Message tabu_send(const Message& message, json content) {
   Message msg;
   msg.address = message.id;
   msg.content = content;
@@ -209,7 +847,7 @@ Message tabu_send_big(const std::string& topic, json content) {
 }
 
 //Constructs and bigSend()s a REPLY message object.
-Message tabu_send_big(Message message, json content) {
+Message tabu_send_big(const Message& message, json content) {
   Message msg;
   msg.address = message.id;
   msg.content = content;
@@ -218,48 +856,158 @@ Message tabu_send_big(Message message, json content) {
   return msg;
 }
 
+//Constructs and bigSend()s a REPLY message with written content.
+Message tabu_send_big_written(const Message& message, std::string written) {
+  Message msg;
+  msg.address = message.id;
+  msg.written = std::move(written);
+  msg.addressKind = REPLY;
+  msg.bigSend();
+  return msg;
+}
+
 // ----- Critical Handler Code ----- //
 // Code here operates on central tabu
 // data and uses TabuLock.
 
-//Accumulating data for "file-transfer" events.
-std::unordered_map<std::string, json> ongoingTransfers;
-json& updateXfer(Message& msg) {
+//A "file-transfer" that's still coming in. Its chunks are
+//parsed as they arrive, rather than all at once at the end.
+struct Transfer {
+  std::string address;
+  json_stream content;
+  //Binary content can't be parsed in pieces, so it's kept until the end.
+  //The first chunk says which kind it is.
+  bool started = false;
+  bool binary = false;
+  std::string binaryText;
+  //Chunks with a seq can arrive more than once, or after later ones
+  //when an earlier one was sent again. The seq that's wanted next, and
+  //the chunks that came in ahead of it.
+  int nextSeq = 0;
+  std::map<int, Message> early;
+  uint32_t lastChunk = 0;
+  //Finished transfers are kept around empty for a while, so that
+  //repeats of their chunks don't start them over.
+  bool finished = false;
+};
+std::unordered_map<std::string, Transfer> ongoingTransfers;
+//Transfers that stop getting chunks are dropped after this long.
+const uint32_t TRANSFER_TIMEOUT = 10000;
+//A sender only gets a window ahead, so this many early chunks means
+//something's gone wrong.
+const size_t MAX_EARLY_CHUNKS = 64;
+//Which transfer a chunk is part of. Our bigSend writes origId, other
+//senders write origID, so either is taken.
+std::string transfer_id(const Message& msg) {
+  std::string_view id;
+  if(msg.try_string("origID", id) || msg.try_string("origId", id)) return std::string(id);
+  throw std::runtime_error("file-transfer chunk has no origID");
+}
+
+Transfer& updateXfer(const Message& msg) {
   TabuLock lk;
-  auto origID = msg.content["origID"].get_string();
-  auto& xfer = ongoingTransfers[origID];
-  auto txt = xfer["text"].is_string() ? xfer["text"].get_string() : "";
-  xfer = json::object({
-    {"text", txt + msg.content["nextData"].get_string()},
-    {"address", msg.content["origAddr"].get_string()},
-    {"id", origID}
-  });
+  auto now = pros::millis();
+  for(auto it = ongoingTransfers.begin(); it != ongoingTransfers.end();) {
+    if(now - it->second.lastChunk >= TRANSFER_TIMEOUT) it = ongoingTransfers.erase(it);
+    else ++it;
+  }
+  auto& xfer = ongoingTransfers[transfer_id(msg)];
+  xfer.address = msg.string("origAddr");
+  xfer.lastChunk = now;
   return xfer;
 }
 
-std::vector<decltype(topicListeners)::value_type> matchingTopicListeners(const Message& msg) {
+void endXfer(const std::string& id) {
   TabuLock lk;
-  std::vector<decltype(topicListeners)::value_type> matching;
-  for(auto& listener: topicListeners) {
-    if(listener.first == msg.address) {
-      matching.push_back(listener);
+  ongoingTransfers.erase(id);
+}
+
+void finishXfer(const std::string& id) {
+  TabuLock lk;
+  auto& xfer = ongoingTransfers[id];
+  auto lastChunk = xfer.lastChunk;
+  xfer = Transfer();
+  xfer.finished = true;
+  xfer.lastChunk = lastChunk;
+}
+
+//Listeners for the exact topic, and for any patterns that match it.
+//The patterns list is left empty, and unallocated, when none do.
+struct MatchingListeners {
+  TopicListeners exact;
+  std::vector<TopicListeners> patterns;
+  template<typename Fn>
+  void each(Fn fn) const {
+    fn(exact);
+    for(auto& found: patterns) fn(found);
+  }
+  bool has_raw() const {
+    bool ret = false;
+    each([&](const TopicListeners& found) { ret |= (bool)found.raw; });
+    return ret;
+  }
+  bool has_listeners() const {
+    bool ret = false;
+    each([&](const TopicListeners& found) { ret |= (bool)found.listeners; });
+    return ret;
+  }
+};
+
+void add_matching(const TopicListeners& found, std::vector<TopicListeners>& out) {
+  if(found.listeners || found.raw) out.push_back(found);
+}
+
+//topic is what's left of it under node.
+void match_patterns(const TopicNode& node, std::string_view topic, std::vector<TopicListeners>& out) {
+  add_matching(node.rest, out);
+  auto dot = topic.find('.');
+  auto part = topic.substr(0, dot);
+  auto found = node.children.find(part);
+  const TopicNode* next[] = {found == node.children.end() ? nullptr : found->second.get(), node.any.get()};
+  for(auto child: next) {
+    if(!child) continue;
+    if(dot == std::string_view::npos) {
+      add_matching(child->here, out);
+      add_matching(child->rest, out);
+    } else {
+      match_patterns(*child, topic.substr(dot + 1), out);
     }
   }
-  return matching;
+}
+
+//Both kinds of listener for msg's topic. Copying them out only copies
+//the list pointers.
+MatchingListeners matchingTopicListeners(const Message& msg) {
+  TabuLock lk;
+  MatchingListeners ret;
+  auto found = topicListeners.find(msg.address);
+  if(found != topicListeners.end()) ret.exact = found->second;
+  if(anyTopicPatterns) match_patterns(topicPatterns, msg.address, ret.patterns);
+  return ret;
+}
+
+//For bigSend, when it gives up on chunks.
+void drop_reply_listeners(const std::deque<OutgoingChunk>& chunks) {
+  TabuLock lk;
+  for(auto& chunk: chunks) replyListeners.erase(chunk.id);
 }
 
 std::vector<ReplyListener> matchingReplyListeners(const Message& msg) {
   TabuLock lk;
+  sweep_replies();
   std::vector<ReplyListener> matching;
-  replyListeners.erase(std::remove_if(replyListeners.begin(), replyListeners.end(),
-  [&](const ReplyListener& parent) {
-      if(parent.first.id == msg.address) {
-        matching.push_back(parent);
-        return true;
-      }
-      return false;
-  }), replyListeners.end());
-  if(matching.empty()) orphanReplies.push_back(msg);
+  auto found = replyListeners.equal_range(msg.address);
+  for(auto it = found.first; it != found.second; ++it) {
+    matching.push_back(std::move(it->second));
+  }
+  replyListeners.erase(found.first, found.second);
+  if(matching.empty()) {
+    if(orphanReplies.size() < MAX_ORPHANS) {
+      orphanReplies[msg.address] = {msg, pros::millis() + ORPHAN_TIMEOUT};
+    } else {
+      replyStats.orphansDropped++;
+    }
+  }
   return matching;
 }
 
@@ -268,47 +1016,143 @@ std::vector<ReplyListener> matchingReplyListeners(const Message& msg) {
 void tabu_init();
 //Parses and handles a line of serial input, calling appropriate listeners and critical sections.
 bool tabu_handler_first_call = true;
-void tabu_handler(const std::string& line) {
+//Lines that weren't messages at all, see the "tabu.input" topic.
+std::atomic<uint32_t> garbageLines{0};
+//Incoming frames, see the "tabu.framing" topic. Only the input task
+//touches these.
+std::string frameScratch;
+uint32_t framesIn = 0;
+uint32_t badFrames = 0;
+uint32_t lostFrames = 0;
+//Frames with a seq behind the one we want, sent twice or late, or from
+//a peer that started its seqs over.
+uint32_t repeatFrames = 0;
+uint16_t nextFrameIn = 0;
+void tabu_handler(std::string_view line) {
   try {
     if(tabu_handler_first_call) {
       tabu_handler_first_call = false;
       tabu_init();
     }
-    Message msg(line);
-    if(msg.addressKind == EVENT) {
-      auto matching = matchingTopicListeners(msg);
-      for(auto& listener: matching) {
-        try {
-          listener.second(msg);
-        } catch(...) {
-          printf(("Caught an exception in listener for " + listener.first + "\n").c_str());
-        }
+    //Frames are taken whenever they come, framing only has to be
+    //agreed on for what we send.
+    if(!line.empty() && line[0] == TABU_FRAME_START) {
+      uint16_t seq;
+      if(tabu_unframe(line.substr(1), frameScratch, seq, line) != FRAME_OK) {
+        badFrames++;
+        return;
       }
-    } else {
-      if(msg.addressKind == REPLY) {
-        for(auto& parent: matchingReplyListeners(msg)) {
+      //Seqs wrap, so ones less than half way round are ahead of us,
+      //with a gap of lost frames, and the rest are behind.
+      uint16_t gap = seq - nextFrameIn;
+      if(!framesIn++ || gap < 0x8000) {
+        if(framesIn > 1) lostFrames += gap;
+        nextFrameIn = seq + 1;
+      } else {
+        repeatFrames++;
+      }
+    } else if(!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    //Noise and half-sent lines are common enough that anything that
+    //can't start a message is turned away before it's copied anywhere.
+    if(line.empty() || (line[0] != '=' && line[0] != '@')) {
+      garbageLines++;
+      return;
+    }
+    //Content is only parsed once something needs it, raw listeners don't.
+    //The line is copied once, into the message's arena, since the
+    //reader's buffer gets reused.
+    json_parse_error error;
+    Message msg(std::string(line), Message::DEFER_CONTENT, error);
+    if(error) {
+      printf("Bad message (%s): %.*s\n", error.message().c_str(), (int)line.size(), line.data());
+      return;
+    }
+    tabu_dispatch(msg);
+  } catch(const std::runtime_error& ex) {
+    printf("Caught exception %s\n", ex.what());
+  } catch(...) {
+    printf("Sorry, I don't know what to do with %.*s.\n", (int)line.size(), line.data());
+  }
+}
+
+//PROS's stdin blocks until there's a byte, then gives back whatever else
+//has already come in along with it.
+static int read_stdin(char* buf, size_t size) {
+  int got = read(STDIN_FILENO, buf, size);
+  if(got <= 0) pros::delay(1);
+  return got;
+}
+
+LineReader& tabu_input() {
+  //Room for a framed TABU_MAX_LINE too.
+  static LineReader reader(read_stdin, TABU_MAX_LINE + TABU_MAX_LINE / 254 + 16);
+  return reader;
+}
+
+void tabu_dispatch(Message& msg) {
+  json_parse_error error;
+  auto parseContent = [&]() {
+    if(msg.try_parse_content(error)) return true;
+    printf("Bad content for %s (%s)\n", msg.address.c_str(), error.message().c_str());
+    return false;
+  };
+  if(msg.addressKind == EVENT) {
+    auto matching = matchingTopicListeners(msg);
+    if(matching.has_raw()) {
+      //Raw listeners want JSON text. Messages made here rather than
+      //read in have no text yet, and binary content has to be converted.
+      bool useRaw = msg.deferred && !is_binary_content(msg.raw);
+      std::string text;
+      if(!useRaw) {
+        if(!parseContent()) return;
+        msg.content.write(text);
+      }
+      std::string_view raw = useRaw ? msg.raw : text;
+      matching.each([&](const TopicListeners& found) {
+        if(!found.raw) return;
+        for(auto& listener: *found.raw) {
           try {
-            parent.second(msg, parent.first);
+            (*listener)(msg, raw);
           } catch(...) {
-            printf("Caught exception in reply handler.\n");
+            printf("Caught an exception in raw listener for %s\n", msg.address.c_str());
           }
         }
+      });
+    }
+    if(!matching.has_listeners() || !parseContent()) return;
+    matching.each([&](const TopicListeners& found) {
+      if(!found.listeners) return;
+      for(auto& listener: *found.listeners) {
+        try {
+          (*listener)(msg);
+        } catch(...) {
+          printf("Caught an exception in listener for %s\n", msg.address.c_str());
+        }
+      }
+    });
+  } else {
+    if(msg.addressKind == REPLY) {
+      if(!parseContent()) return;
+      for(auto& parent: matchingReplyListeners(msg)) {
+        try {
+          (*parent.listener)(msg, parent.original);
+        } catch(...) {
+          printf("Caught exception in reply handler.\n");
+        }
       }
     }
-  } catch(const std::runtime_error& ex) {
-    printf("Caught exception %s\n", ex.what());
-  } catch(...) {
-    printf("Sorry, I don't know what to do with %s.\n", line.c_str());
   }
 }
 
 // ----- Output -----
 
-//Sends a line of text to serial output, after encoding it.
 pros::Mutex tabu_lock;
+//Sends a line of text to serial output. It's dropped if the output
+//ring is full, rather than holding up the caller.
 void tabu_say(const std::string& text) {
-  TabuLock lk;
-  puts(text.c_str());
+  tabu_write_line(text, DROP_WHEN_FULL);
 }
 
 // ----- Initialization -----
@@ -318,19 +1162,186 @@ void tabu_init() {
   tabu_reply_on("help", []() -> json {
     return helpRegistry;
   });
+  //Switches the content encoding. Without a mode it just says what
+  //there is, which makes it the handshake for finding out.
+  tabu_reply_on("tabu.mode", [](const Message& msg) -> json {
+    auto& mode = msg.field("mode");
+    if(mode.is_string()) {
+      if(mode.get_string_view() == "json") tabu_set_encoding(JSON_CONTENT);
+      else if(mode.get_string_view() == "cbor") tabu_set_encoding(CBOR_CONTENT);
+      else throw std::runtime_error("No such mode.");
+    }
+    return json::object({
+      {"mode", tabuEncoding == CBOR_CONTENT ? "cbor" : "json"},
+      {"modes", json::array({"json", "cbor"})}
+    });
+  });
+  tabu_reply_on("tabu.replies", []() -> json {
+    auto stats = tabu_reply_stats();
+    return json::object({
+      {"waiting", (double)stats.waiting},
+      {"orphans", (double)stats.orphans},
+      {"timeouts", (double)stats.timeouts},
+      {"orphansExpired", (double)stats.orphansExpired},
+      {"orphansDropped", (double)stats.orphansDropped}
+    });
+  });
+  tabu_help("tabu.replies", {
+    tlabel("Reply bookkeeping: listeners waiting, orphaned replies, and how many timed out."),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  //Sets up how bigSend splits messages, any field that's left out
+  //stays the same. Replies with what it's set to.
+  tabu_reply_on("tabu.transfer", [](const Message& msg) -> json {
+    auto config = tabu_transfer_config();
+    double num;
+    if(msg.try_number("chunkSize", num)) config.chunkSize = std::max(num, 0.0);
+    msg.try_integer("window", config.window);
+    if(msg.try_number("retryTimeout", num)) config.retryTimeout = std::max(num, 0.0);
+    msg.try_integer("maxTries", config.maxTries);
+    msg.try_boolean("seq", config.peerSeq);
+    tabu_set_transfer(config);
+    config = tabu_transfer_config();
+    return json::object({
+      {"chunkSize", (double)config.chunkSize},
+      {"window", (double)config.window},
+      {"retryTimeout", (double)config.retryTimeout},
+      {"maxTries", (double)config.maxTries},
+      {"seq", config.peerSeq}
+    });
+  });
+  tabu_help("tabu.transfer", {
+    tlabel("How big replies are split up: bytes per chunk, chunks in flight, and retries. Windows and resends only happen once seq says file-transfer chunks are put in order by seq."),
+    tnum("chunkSize"),
+    tnum("window"),
+    tnum("retryTimeout", "retryTimeout (ms)"),
+    tnum("maxTries"),
+    tbool("seq"),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  tabu_reply_on("tabu.workers", []() -> json {
+    auto stats = tabu_worker_stats();
+    return json::object({
+      {"workers", (double)stats.workers},
+      {"busy", (double)stats.busy},
+      {"queued", (double)stats.queued},
+      {"mostQueued", (double)stats.mostQueued},
+      {"queueDepth", (double)stats.queueDepth},
+      {"run", (double)stats.run},
+      {"rejected", (double)stats.rejected},
+      {"ownTasks", (double)stats.ownTasks}
+    });
+  });
+  tabu_help("tabu.workers", {
+    tlabel("Async listener pool: busy workers, queued jobs, jobs turned away for a full queue, and long jobs given their own task."),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  tabu_reply_on("tabu.output", []() -> json {
+    auto stats = tabu_output_stats();
+    return json::object({
+      {"waiting", (double)stats.waiting},
+      {"mostWaiting", (double)stats.mostWaiting},
+      {"written", (double)stats.written},
+      {"dropped", (double)stats.dropped},
+      {"waited", (double)stats.waited}
+    });
+  });
+  tabu_help("tabu.output", {
+    tlabel("Output ring: lines waiting to be written, and how many were dropped or had to wait for room."),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  tabu_reply_on("tabu.input", []() -> json {
+    auto& input = tabu_input();
+    return json::object({
+      {"lines", (double)input.lines},
+      {"reads", (double)input.reads},
+      {"tooLong", (double)input.tooLong},
+      {"garbage", (double)garbageLines},
+      {"maxLine", (double)TABU_MAX_LINE}
+    });
+  });
+  tabu_help("tabu.input", {
+    tlabel("Serial input: lines and reads so far, and lines thrown away for being too long or not messages."),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  //Turns framing of what we send on or off (see tabu_frame.hpp). The
+  //reply goes out the old way, everything after it the new way. It's
+  //synchronous so that lines read after it are handled after the switch.
+  tabu_on("tabu.framing", [](const Message& msg) {
+    bool framed = framedOutput;
+    msg.try_boolean("framed", framed);
+    tabu_send(msg, json::object({
+      {"framed", framed},
+      {"framesIn", (double)framesIn},
+      {"badFrames", (double)badFrames},
+      {"lostFrames", (double)lostFrames},
+      {"repeatFrames", (double)repeatFrames}
+    }));
+    framedOutput = framed;
+  });
+  tabu_help("tabu.framing", {
+    tlabel("Sends lines as COBS frames with a seq and CRC32 once framed is set. Counts frames received, dropped as bad, missing, and repeated or behind."),
+    tbool("framed"),
+    treplyaction("say(JSON.stringify(it))")
+  });
+  tabu_help("tabu.mode", {
+    tlabel("Content encoding, json or cbor (sent as ~ then base64)"),
+    tstr("mode"),
+    treplyaction("say(JSON.stringify(it))")
+  });
   //Handles large file transfers
-  tabu_on("file-transfer", [](Message msg) {
+  tabu_on("file-transfer", [](const Message& msg) {
     auto &xfer = updateXfer(msg);
-    //Always send a reply
+    //Always send a reply, even to a repeat, in case it was our reply
+    //that got lost.
     tabu_send(msg);
-    if(msg.content["done"].get_bool()) {
+    auto id = transfer_id(msg);
+    if(xfer.finished) return;
+    try {
+      //Chunks without a seq are from senders that only ever have one
+      //out at a time, so they're always next.
+      int seq;
+      if(msg.try_integer("seq", seq)) {
+        if(seq < xfer.nextSeq) return;
+        if(seq > xfer.nextSeq) {
+          if(xfer.early.size() == MAX_EARLY_CHUNKS) throw std::runtime_error("Too many chunks out of order");
+          xfer.early.emplace(seq, msg);
+          return;
+        }
+      }
+      Message chunk = msg;
+      while(true) {
+        auto nextData = chunk.field("nextData").get_string_view();
+        if(!xfer.started) {
+          xfer.started = true;
+          xfer.binary = is_binary_content(nextData);
+        }
+        if(xfer.binary) xfer.binaryText += nextData;
+        else xfer.content.feed(nextData);
+        xfer.nextSeq++;
+        if(chunk.boolean("done")) break;
+        auto found = xfer.early.find(xfer.nextSeq);
+        if(found == xfer.early.end()) return;
+        chunk = std::move(found->second);
+        xfer.early.erase(found);
+      }
       Message constructed;
-      constructed.addressKind = xfer["address"].get_string()[0] == '=' ? EVENT : REPLY;
-      constructed.address = xfer["address"].get_string().substr(1);
-      constructed.id = xfer["id"].get_string();
-      constructed.content = json::parse(xfer["text"].get_string());
-      { TabuLock lk; ongoingTransfers.erase(ongoingTransfers.find(constructed.id)); }
-      tabu_handler(constructed.text());
+      constructed.addressKind = xfer.address[0] == '=' ? EVENT : REPLY;
+      constructed.address = xfer.address.substr(1);
+      constructed.id = id;
+      if(xfer.binary) {
+        json_parse_error error;
+        constructed.content = parse_binary_content(xfer.binaryText, error);
+        if(error) throw std::runtime_error(error.message());
+      } else {
+        constructed.content = xfer.content.finish();
+      }
+      finishXfer(id);
+      tabu_dispatch(constructed);
+    } catch(...) {
+      //A transfer that can't be parsed is never going to finish.
+      endXfer(id);
+      throw;
     }
   });
 }
\ No newline at end of file
@@ -14,68 +14,266 @@ struct Message {
   AddressKind addressKind;
   std::string address;
   std::string id;
+  //Incoming messages are parsed into this, it has to outlive content.
+  std::shared_ptr<json_arena> arena;
+  //Content text as it was received. Points into arena.
+  std::string_view raw;
+  //Set while raw hasn't been parsed into content yet.
+  bool deferred = false;
   json content;
+  //Content that's already been written out as JSON text (see
+  //json_bind.hpp). When it's set it gets sent in place of content.
+  std::string written;
+  enum ContentParsing { PARSE_CONTENT, DEFER_CONTENT };
   Message();
-  explicit Message(const std::string& text);
+  //Copies share content (and its arena), so passing messages around
+  //by value doesn't copy any of the JSON.
+  Message(const Message& orig);
+  Message& operator=(const Message& orig);
+  Message(Message&& orig) = default;
+  Message& operator=(Message&& orig) = default;
+  explicit Message(std::string line, ContentParsing parsing = PARSE_CONTENT);
+  //Doesn't throw for a malformed line, it fills in error instead,
+  //and the message shouldn't be used.
+  Message(std::string line, ContentParsing parsing, json_parse_error& error);
+  //Fills in content from raw, for messages made with DEFER_CONTENT.
+  //Does nothing if that's already been done.
+  void parse_content();
+  //Same, but returns false with error filled in instead of throwing.
+  bool try_parse_content(json_parse_error& error);
   std::string text();
+  void text(std::string& out);
   void send();
   void bigSend();
-  double number(const std::string& key) {
-    return content[key].get_number();
+  //These throw if key is missing or the wrong type. They only read
+  //content, so shared content doesn't get copied.
+  double number(const std::string& key) const {
+    return field(key).get_number();
   }
-  int integer(const std::string& key) {
-    return content[key].get_number();
+  int integer(const std::string& key) const {
+    return field(key).get_number();
   }
-  std::string string(const std::string& key) {
-    return content[key].get_string();
+  std::string string(const std::string& key) const {
+    return field(key).get_string();
   }
-  bool boolean(const std::string& key) {
-    return content[key].get_bool();
+  bool boolean(const std::string& key) const {
+    return field(key).get_bool();
   }
+  //The value at key in content, or a null if it isn't there.
+  const json& field(std::string_view key) const;
+  //Non-throwing helpers. They return false if key is missing or the
+  //wrong type, and never add it to content.
+  bool try_number(std::string_view key, double& out) const {
+    auto val = content.try_get(key);
+    return val && val->try_get_number(out);
+  }
+  bool try_integer(std::string_view key, int& out) const {
+    double val;
+    if(!try_number(key, val)) return false;
+    out = val;
+    return true;
+  }
+  bool try_string(std::string_view key, std::string_view& out) const {
+    auto val = content.try_get(key);
+    return val && val->try_get_string(out);
+  }
+  bool try_boolean(std::string_view key, bool& out) const {
+    auto val = content.try_get(key);
+    return val && val->try_get_bool(out);
+  }
+  //Same as boolean, but false when the key isn't there, for
+  //options that older senders don't know about.
+  bool flag(std::string_view key) const {
+    bool val;
+    return try_boolean(key, val) && val;
+  }
+  private:
+  //Shared by the constructors that take a line.
+  bool read(std::string line, ContentParsing parsing, json_parse_error& error);
 };
 
 Message tabu_send(const std::string& topic, json content = json::object({}));
-Message tabu_send(Message toReply, json content = json::object({}));
+Message tabu_send(const Message& toReply, json content = json::object({}));
 Message tabu_send_big(const std::string& topic, json content = json::object({}));
-Message tabu_send_big(Message toReply, json content = json::object({}));
+Message tabu_send_big(const Message& toReply, json content = json::object({}));
+//Same, with content that's already JSON text.
+Message tabu_send_big_written(const Message& toReply, std::string written);
+
+//Async listeners run on a pool of worker tasks, taking jobs from a
+//queue. A job that comes when the queue is full is turned away: requests
+//get a busy reply (see tabu_on_request), other listeners miss the message.
+//The pool starts when the first job comes, so set this up before then.
+struct TabuWorkerConfig {
+  int workers = 3;
+  int queueDepth = 16;
+  uint32_t priority = TASK_PRIORITY_DEFAULT;
+  uint16_t stackDepth = TASK_STACK_DEPTH_DEFAULT;
+};
+void tabu_set_workers(const TabuWorkerConfig& config);
+//See the "tabu.workers" topic.
+struct TabuWorkerStats {
+  int workers = 0;
+  int queueDepth = 0;
+  //Jobs waiting now, and the most there's been.
+  uint32_t queued = 0;
+  uint32_t mostQueued = 0;
+  //Workers running a job now.
+  int busy = 0;
+  uint32_t run = 0;
+  uint32_t rejected = 0;
+  //Jobs that were given a task of their own, see TabuRunOn.
+  uint32_t ownTasks = 0;
+};
+TabuWorkerStats tabu_worker_stats();
+//Where a listener that runs in the background goes. POOLED is the worker
+//pool. OWN_TASK starts a task just for that message, for handlers that
+//run for seconds (tests that drive the robot, and wait on bigSend) and
+//would otherwise hold a worker all that time.
+enum TabuRunOn { POOLED, OWN_TASK };
+//Runs job in the background. False, without running it, if it was to be
+//POOLED and the queue was full.
+bool tabu_run_async(std::function<void()> job, TabuRunOn runOn = POOLED);
 
 //Main listener adders, void(inputs)
-void tabu_on(const std::string& topic, std::function<void(Message)> listener, bool async = false);
-void tabu_on(Message repliedTo, std::function<void(Message, Message)> listener, bool async = false);
+//Listeners get the message by const reference, it's only copied for
+//async ones, which need their own. Listeners that still take a Message
+//by value work too, std::function copies it for them.
+//Topics can have wildcards for a whole part: "blue_control.*" gets any
+//one part after blue_control., "simple_follower.#" gets simple_follower
+//and everything under it. "#" can only be the last part.
+void tabu_on(const std::string& topic, std::function<void(const Message&)> listener, bool async = false);
+//Reply listeners wait for as long as it takes, unless they're given a
+//timeout (in milliseconds). Then they're dropped, without being called,
+//if no reply comes in time. Only use one where that's the right thing.
+void tabu_on(const Message& repliedTo, std::function<void(const Message&, const Message&)> listener, bool async = false, uint32_t timeout = 0);
+//Listens to a topic without ever building content. The listener gets
+//the message (with an empty content) and the raw JSON text, which it can
+//pick apart with json::parse_events. Always runs synchronously.
+void tabu_on_raw(const std::string& topic, std::function<void(const Message&, std::string_view)> listener);
+//Async listeners for messages that want a reply. If the job is turned
+//away the message is replied to with {"error": "busy"}, so the other end
+//isn't left waiting for a reply that'll never come.
+void tabu_on_request(const std::string& topic, std::function<void(const Message&)> listener, TabuRunOn runOn = POOLED);
+void tabu_on_request(const Message& repliedTo, std::function<void(const Message&, const Message&)> listener, TabuRunOn runOn = POOLED);
 //Calls previous listener adders, and replies with a json value.
-inline void tabu_reply_on(const std::string& topic, std::function<json(Message)> listener) {
-  tabu_on(topic, [=](Message received) {
+inline void tabu_reply_on(const std::string& topic, std::function<json(const Message&)> listener, TabuRunOn runOn = POOLED) {
+  tabu_on_request(topic, [=](const Message& received) {
     tabu_send_big(received, listener(received));
-  }, true);
+  }, runOn);
 }
-inline void tabu_reply_on(Message& repliedTo, std::function<json(Message, Message)> listener) {
-  tabu_on(repliedTo, [=](const Message reply, Message original) {
+inline void tabu_reply_on(const Message& repliedTo, std::function<json(const Message&, const Message&)> listener, TabuRunOn runOn = POOLED) {
+  tabu_on_request(repliedTo, [=](const Message& reply, const Message& original) {
     tabu_send_big(reply, listener(reply, original));
-  }, true);
+  }, runOn);
+}
+//Replies with JSON text that the listener writes onto out, for replies
+//that are written straight from structs rather than built as json.
+inline void tabu_reply_written_on(const std::string& topic, std::function<void(const Message&, std::string&)> listener, TabuRunOn runOn = POOLED) {
+  tabu_on_request(topic, [=](const Message& received) {
+    std::string out;
+    listener(received, out);
+    tabu_send_big_written(received, std::move(out));
+  }, runOn);
 }
 //Argumentless wrappers
 inline void tabu_on(const std::string& topic, std::function<void()> listener, bool async = false) {
-  tabu_on(topic, [=](Message) { listener(); }, async);
+  tabu_on(topic, [=](const Message&) { listener(); }, async);
 }
-inline void tabu_on(Message repliedTo, std::function<void()> listener, bool async = false) {
-  tabu_on(repliedTo, [=](Message, Message ) { listener(); }, async);
+inline void tabu_on(const Message& repliedTo, std::function<void()> listener, bool async = false) {
+  tabu_on(repliedTo, [=](const Message&, const Message&) { listener(); }, async);
 }
-inline void tabu_reply_on(const std::string& topic, std::function<json()> listener) {
-  tabu_on(topic, [=](Message received) {
+inline void tabu_reply_on(const std::string& topic, std::function<json()> listener, TabuRunOn runOn = POOLED) {
+  tabu_on_request(topic, [=](const Message& received) {
     tabu_send_big(received, listener());
-  }, true);
+  }, runOn);
 }
-inline void tabu_reply_on(Message repliedTo, std::function<json()> listener) {
-  tabu_on(repliedTo, [=](Message reply, Message original) {
+inline void tabu_reply_on(const Message& repliedTo, std::function<json()> listener, TabuRunOn runOn = POOLED) {
+  tabu_on_request(repliedTo, [=](const Message& reply, const Message& original) {
     tabu_send_big(reply, listener());
-  }, true);
+  }, runOn);
 }
 
-void tabu_handler(const std::string& line);
+//How content is written when sending. JSON_CONTENT is plain JSON text,
+//CBOR_CONTENT is ~ followed by base64 CBOR (see json::write_cbor), which
+//keeps lines free of newlines. Received content can be either one, the
+//~ tells them apart. The "tabu.mode" topic switches between them.
+//bigSend's file-transfer segments are JSON text either way, their
+//nextData is pieces of the encoded content.
+enum ContentEncoding {JSON_CONTENT, CBOR_CONTENT};
+void tabu_set_encoding(ContentEncoding encoding);
+
+//How bigSend splits messages up, see the "tabu.transfer" topic.
+struct TabuTransferConfig {
+  //Bytes of content per file-transfer chunk.
+  size_t chunkSize = 512;
+  //Chunks that can be waiting on a reply at once. 1 sends a chunk
+  //and waits for it, like it used to. Only used once peerSeq is set.
+  int window = 4;
+  //A chunk is sent again when it's had no reply for this long (ms),
+  //and the send is given up on after maxTries. Without peerSeq it's
+  //never sent again, and waits for its reply however long that takes.
+  //Either way, a chunk that didn't fit in the output ring is written
+  //again, and the send is given up on after maxTries of those in a row.
+  uint32_t retryTimeout = 500;
+  int maxTries = 5;
+  //Set once the other end has said (with "seq" in "tabu.transfer")
+  //that it puts chunks in order by seq and ignores repeats. Peers that
+  //don't would append a chunk that was only slow twice.
+  bool peerSeq = false;
+};
+void tabu_set_transfer(const TabuTransferConfig& config);
+TabuTransferConfig tabu_transfer_config();
+//Appends content onto out the way it'd be sent.
+void tabu_write_content(const json& content, std::string& out);
+
+//Counts for the reply bookkeeping, see the "tabu.replies" topic.
+struct TabuReplyStats {
+  //Listeners still waiting, and replies nobody was waiting for.
+  size_t waiting = 0;
+  size_t orphans = 0;
+  //Listeners with a timeout that gave up waiting.
+  uint32_t timeouts = 0;
+  //Orphans thrown away for being too old, or for there being too many.
+  uint32_t orphansExpired = 0;
+  uint32_t orphansDropped = 0;
+};
+TabuReplyStats tabu_reply_stats();
+
+void tabu_handler(std::string_view line);
+//Reads serial input a line at a time for tabu_handler. Longer lines
+//than TABU_MAX_LINE are thrown away. Only the input task reads from it.
+const size_t TABU_MAX_LINE = 8192;
+class LineReader;
+LineReader& tabu_input();
+//Calls the listeners for an already-made message.
+void tabu_dispatch(Message& msg);
 
 extern pros::Mutex tabu_lock;
 void tabu_say(const std::string& text);
 
+//Everything tabu sends goes through a ring of lines that a writer task
+//drains, so senders never wait on serial. When the ring is full a line
+//is either dropped, or waits up to TABU_OUTPUT_WAIT ms for room and is
+//dropped after that. Messages wait, tabu_say drops.
+//Starts the writer task. Call it from initialize, lines sent before
+//then wait in the ring.
+void tabu_start_output();
+enum TabuOutputPolicy { DROP_WHEN_FULL, WAIT_WHEN_FULL };
+const uint32_t TABU_OUTPUT_WAIT = 500;
+//False if the line was dropped.
+bool tabu_write_line(std::string_view line, TabuOutputPolicy policy);
+//See the "tabu.output" topic.
+struct TabuOutputStats {
+  //Lines in the ring now, and the most there's been.
+  uint32_t waiting = 0;
+  uint32_t mostWaiting = 0;
+  uint32_t written = 0;
+  uint32_t dropped = 0;
+  //Lines that had to wait for room.
+  uint32_t waited = 0;
+};
+TabuOutputStats tabu_output_stats();
+
 void tabu_help(const std::string& topic, const json& help);
 
 inline json tlabel(const std::string& text) {
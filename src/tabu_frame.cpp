@@ -0,0 +1,95 @@
+#include "tabu_frame.hpp"
+#include "crc.hpp"
+
+//Everything written is xored with this, so that COBS's zeros end up
+//being the one byte that's never sent.
+static const uint8_t FLIP = '\n';
+static const size_t HEADER_SIZE = 6;
+static const size_t CRC_SIZE = 4;
+
+namespace {
+
+//COBS, a byte at a time. Each block starts with a code byte saying how
+//far it is to the next zero, which is left out. A code of 0xFF means 254
+//bytes with no zero after them.
+class cobs_writer {
+  std::string& out;
+  size_t codePos;
+  uint8_t code = 1;
+  void end_block() {
+    out[codePos] = code ^ FLIP;
+    codePos = out.size();
+    out += '\0';
+    code = 1;
+  }
+  public:
+  explicit cobs_writer(std::string& out): out(out), codePos(out.size()) {
+    out += '\0';
+  }
+  void put(uint8_t byte) {
+    if(!byte) {
+      end_block();
+      return;
+    }
+    out += (char)(byte ^ FLIP);
+    if(++code == 0xFF) end_block();
+  }
+  void put(const void* data, size_t len) {
+    auto pos = (const uint8_t*)data;
+    for(size_t i = 0; i < len; i++) put(pos[i]);
+  }
+  void finish() {
+    out[codePos] = code ^ FLIP;
+  }
+};
+
+void put_le(uint8_t* to, uint32_t val, int size) {
+  for(int i = 0; i < size; i++) to[i] = val >> (8 * i);
+}
+
+uint32_t get_le(const char* from, int size) {
+  uint32_t val = 0;
+  for(int i = 0; i < size; i++) val |= (uint32_t)(uint8_t)from[i] << (8 * i);
+  return val;
+}
+
+}
+
+void tabu_frame(std::string_view line, uint16_t seq, std::string& out) {
+  out.reserve(out.size() + line.size() + line.size() / 254 + HEADER_SIZE + CRC_SIZE + 3);
+  out += TABU_FRAME_START;
+  uint8_t header[HEADER_SIZE];
+  put_le(header, seq, 2);
+  put_le(header + 2, line.size(), 4);
+  uint32_t crc = VEX_CRC32(line.data(), line.size(), VEX_CRC32(header, HEADER_SIZE));
+  uint8_t trailer[CRC_SIZE];
+  put_le(trailer, crc, CRC_SIZE);
+  cobs_writer writer(out);
+  writer.put(header, HEADER_SIZE);
+  writer.put(line.data(), line.size());
+  writer.put(trailer, CRC_SIZE);
+  writer.finish();
+}
+
+TabuFrameResult tabu_unframe(std::string_view frame, std::string& scratch, uint16_t& seq, std::string_view& line) {
+  scratch.clear();
+  size_t pos = 0;
+  while(pos < frame.size()) {
+    uint8_t code = frame[pos++] ^ FLIP;
+    if(!code || code - 1 > frame.size() - pos) return FRAME_BAD_COBS;
+    for(int i = 1; i < code; i++) {
+      char byte = frame[pos++] ^ FLIP;
+      if(!byte) return FRAME_BAD_COBS;
+      scratch += byte;
+    }
+    if(code != 0xFF && pos < frame.size()) scratch += '\0';
+  }
+  if(scratch.size() < HEADER_SIZE + CRC_SIZE) return FRAME_BAD_LENGTH;
+  size_t len = get_le(scratch.data() + 2, 4);
+  if(len != scratch.size() - HEADER_SIZE - CRC_SIZE) return FRAME_BAD_LENGTH;
+  uint32_t crc = VEX_CRC32(scratch.data(), HEADER_SIZE + len);
+  if(crc != get_le(scratch.data() + HEADER_SIZE + len, CRC_SIZE)) return FRAME_BAD_CRC;
+  seq = get_le(scratch.data(), 2);
+  line = std::string_view(scratch.data() + HEADER_SIZE, len);
+  return FRAME_OK;
+}
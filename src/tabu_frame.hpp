@@ -0,0 +1,27 @@
+#pragma once
+//Optional framing for tabu lines, so a byte that gets mangled on the way
+//(Bluetooth especially) drops the line instead of changing what it says.
+//A frame is still one line: '#', then the COBS encoding of
+//
+//  seq (2 bytes) | length (4) | the line | CRC32 of everything before (4)
+//
+//all little endian, with every byte xored with '\n'. COBS takes out the
+//zeros and the xor turns them into the newlines, so a frame never has a
+//'\n' in it and goes through the same line reading as plain lines do.
+//The CRC is VEX_CRC32 (crc.hpp) starting from 0. Doesn't need the
+//robot, so it builds on a host too.
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+const char TABU_FRAME_START = '#';
+
+//Appends line framed, without a '\n', onto out.
+void tabu_frame(std::string_view line, uint16_t seq, std::string& out);
+
+enum TabuFrameResult { FRAME_OK, FRAME_BAD_COBS, FRAME_BAD_LENGTH, FRAME_BAD_CRC };
+//Takes a frame without its '#'. The line is decoded into scratch, and
+//line points into it, so it's only good until scratch is used again.
+//Never throws, a bad frame is just a result.
+TabuFrameResult tabu_unframe(std::string_view frame, std::string& scratch, uint16_t& seq, std::string_view& line);